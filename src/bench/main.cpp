@@ -0,0 +1,497 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "allocations.hpp"
+#include "config.hpp"
+#include "game.hpp"
+#include "random.hpp"
+#include "replay.hpp"
+#include "session.hpp"
+#include "workers.hpp"
+
+// Headless SandGrid benchmark. Prints one CSV row per scenario, grid size and
+// phase. What an item is depends on the phase: the update phases count every
+// grain on the board once per tick whether it moved or not, find_areas counts
+// the areas found and remove_areas the grains removed.
+//
+// With --replay FILE it plays a recording made by tetrisand --record FILE
+// instead, as fast as it can, and fails when the grid doesn't end up the
+// way it did when the game was recorded. --board FILE runs the phases on the
+// grid of a snapshot saved by tetrisand --save FILE.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Size {
+    uint32_t width;
+    uint32_t height;
+};
+
+const std::vector<Size> sizes({{80, 160}, {256, 512}, {1024, 2048},
+                               {2048, 4096}});
+
+// Roughly how many cells every phase gets to touch, so small boards run
+// many iterations and the big ones only a handful.
+const uint64_t cellBudget = 50'000'000;
+
+// the boards are the same on every run
+utils::Random random(0);
+
+const game::ShapeRegistry shapes = cfg::load_shapes(nullptr);
+
+uint8_t random_color() { return random.below(cfg::maskColors.size()); }
+
+game::Grain sand(uint8_t color) {
+    return {game::GrainState::sand, 0xFF, color};
+}
+
+void fill_empty(game::SandGrid&) {}
+
+// Bottom half is a settled pile of random colors
+void fill_half(game::SandGrid& grid) {
+    for (uint32_t y = grid.height() / 2; y < grid.height(); y++) {
+        for (uint32_t x = 0; x < grid.width(); x++) {
+            grid.set(x, y, sand(random_color()));
+        }
+    }
+}
+
+// Every other cell holds a grain, so nearly everything is falling
+void fill_loose(game::SandGrid& grid) {
+    for (uint32_t y = 0; y < grid.height(); y++) {
+        for (uint32_t x = 0; x < grid.width(); x++) {
+            if (random.next() & 1) {
+                grid.set(x, y, sand(random_color()));
+            }
+        }
+    }
+}
+
+// Bottom half is made of 8x8 blocks of random colors with one spanning
+// stripe on top of it
+void fill_areas(game::SandGrid& grid) {
+    const uint32_t block = 8;
+    const uint32_t top = grid.height() / 2;
+
+    for (uint32_t by = top; by < grid.height(); by += block) {
+        for (uint32_t bx = 0; bx < grid.width(); bx += block) {
+            const auto color = random_color();
+            for (uint32_t y = by; y < by + block && y < grid.height(); y++) {
+                for (uint32_t x = bx; x < bx + block && x < grid.width();
+                     x++) {
+                    grid.set(x, y, sand(color));
+                }
+            }
+        }
+    }
+
+    for (uint32_t y = top - 4; y < top; y++) {
+        for (uint32_t x = 0; x < grid.width(); x++) {
+            grid.set(x, y, sand(0));
+        }
+    }
+}
+
+struct Scenario {
+    std::string name;
+    std::function<void(game::SandGrid&)> fill;
+};
+
+const std::vector<Scenario> scenarios({
+    {"empty", fill_empty},
+    {"half", fill_half},
+    {"loose", fill_loose},
+    {"areas", fill_areas},
+});
+
+uint64_t count_sand(const game::SandGrid& grid) {
+    uint64_t count = 0;
+    for (uint32_t y = 0; y < grid.height(); y++) {
+        for (uint32_t x = 0; x < grid.width(); x++) {
+            count += grid.at(x, y).state == game::GrainState::sand;
+        }
+    }
+    return count;
+}
+
+struct Result {
+    uint64_t iterations = 0;
+    uint64_t ns = 0;
+    uint64_t items = 0;
+};
+
+void report(const std::string& scenario, const game::SandGrid& grid,
+            const std::string& phase, const Result& result) {
+    if (result.iterations == 0) {
+        return;
+    }
+
+    const double cells = static_cast<double>(grid.width()) * grid.height();
+    const double seconds = result.ns / 1e9;
+
+    std::cout << scenario << ',' << grid.width() << ',' << grid.height() << ','
+              << phase << ',' << result.iterations << ',' << result.ns << ','
+              << result.ns / (cells * result.iterations) << ','
+              << result.iterations / seconds << ','
+              << result.items / seconds << std::endl;
+}
+
+uint64_t iterations_for(const game::SandGrid& grid) {
+    const uint64_t cells = static_cast<uint64_t>(grid.width()) * grid.height();
+    return std::max<uint64_t>(cellBudget / cells, 3);
+}
+
+uint64_t elapsed_ns(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start)
+        .count();
+}
+
+// Runs update on a copy of the board once per iteration, every grain on the
+// board counts as an item of every call
+Result bench_update(const game::SandGrid& board,
+                    const std::function<void(game::SandGrid&)>& update) {
+    auto grid = board;
+    const auto grains = count_sand(grid);
+
+    Result result;
+    result.iterations = iterations_for(grid);
+
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        update(grid);
+    }
+    result.ns = elapsed_ns(start);
+    result.items = grains * result.iterations;
+    return result;
+}
+
+// Drops solids from the top like collision_resolution does in the game until
+// one of them lands. Every move counts as one iteration.
+Result bench_solids(const game::SandGrid& board) {
+    auto grid = board;
+    Result result;
+
+    // make room for spawning, the solids are at most 32 cells tall
+    for (uint32_t y = 0; y < 32 && y < grid.height(); y++) {
+        for (uint32_t x = 0; x < grid.width(); x++) {
+            grid.set(x, y, game::Grain::empty());
+        }
+    }
+
+    const auto start = Clock::now();
+    for (uint32_t i = 0; i < shapes.size(); i++) {
+        const game::Solid solid{i, 0, 0, grid.width() / 3, 0};
+        try {
+            grid.place_solid(solid);
+        } catch (const game::game_over_error&) {
+            break;
+        }
+
+        while (!grid.does_current_solid_collide()) {
+            grid.move_current_solid(game::Direction::down);
+            result.iterations++;
+        }
+        grid.convert_current_solid_to_sand();
+        result.iterations++;
+    }
+    result.ns = elapsed_ns(start);
+    return result;
+}
+
+Result bench_find_areas(const game::SandGrid& grid) {
+    game::AreaFinder areas;
+    Result result;
+    result.iterations = iterations_for(grid);
+
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        result.items += areas.find(grid);
+    }
+    result.ns = elapsed_ns(start);
+    return result;
+}
+
+// Like the game does after every sand tick: a grain changes, then the grid
+// is checked for spanning areas again. The grain is written back as it was,
+// so the board stays the same over all iterations.
+Result bench_find_areas_incremental(const game::SandGrid& board) {
+    auto grid = board;
+    grid.find_areas();
+
+    Result result;
+    result.iterations = iterations_for(grid);
+
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        const uint32_t x = random.below(grid.width());
+        const uint32_t y = random.below(grid.height());
+        grid.set(x, y, grid.at(x, y));
+        result.items += grid.find_areas();
+    }
+    result.ns = elapsed_ns(start);
+    return result;
+}
+
+std::optional<Result> bench_remove_areas(const game::SandGrid& board) {
+    game::AreaFinder areas;
+    if (areas.find(board) == 0) {
+        return std::nullopt;
+    }
+
+    Result result;
+    result.iterations = std::min<uint64_t>(iterations_for(board), 50);
+
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        auto grid = board;
+        areas.find(grid);
+        const auto start = Clock::now();
+        result.items += areas.remove(grid);
+        result.ns += elapsed_ns(start);
+    }
+    return result;
+}
+
+Result bench_snapshot_save(const game::SandGrid& board) {
+    std::ostringstream out;
+
+    Result result;
+    result.iterations = iterations_for(board);
+
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        out.str("");
+        board.save(out);
+    }
+    result.ns = elapsed_ns(start);
+    return result;
+}
+
+// Fails when the loaded grid isn't the same as the board, or the sand on
+// them doesn't move the same for a few ticks. The board is saved a few ticks
+// in with a row taken out of the pile, so some chunks are asleep and others
+// were only just woken up.
+Result bench_snapshot_load(const game::SandGrid& board) {
+    auto saved = board;
+    for (int tick = 0; tick < 4; tick++) {
+        saved.update_sand();
+    }
+    saved.erase(0, saved.height() * 3 / 4 + 2, saved.width());
+    std::ostringstream out;
+    saved.save(out);
+    const std::string snapshot = out.str();
+
+    std::istringstream check(snapshot);
+    auto loaded = game::SandGrid::load(check, shapes);
+    for (int tick = 0; tick <= 8; tick++) {
+        if (loaded.hash() != saved.hash()) {
+            throw std::runtime_error("a loaded snapshot doesn't play on like "
+                                     "the saved grid");
+        }
+        loaded.update_sand();
+        saved.update_sand();
+    }
+
+    Result result;
+    result.iterations = iterations_for(board);
+
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        std::istringstream in(snapshot);
+        game::SandGrid::load(in, shapes);
+    }
+    result.ns = elapsed_ns(start);
+    return result;
+}
+
+game::Input random_input() {
+    const uint64_t keys = random.next();
+    return {(keys & 7) == 0, (keys & 7) == 1, (keys & 7) == 2,
+            (keys >> 3 & 31) == 0};
+}
+
+// Plays with random keys one tick at a time and starts over after game
+// over. Ticks may only allocate for the grid's storage growing as sand
+// reaches new parts of the board, allocations counts every other one.
+Result bench_ticks(const Size& size, uint64_t& allocations) {
+    const auto start_session = [&size] {
+        return game::Session(size.width, size.height, shapes,
+                             cfg::maskColors.size(), random.next());
+    };
+    auto session = start_session();
+
+    Result result;
+    result.iterations = iterations_for(session.grid());
+
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        if (session.is_over()) {
+            session = start_session();
+        }
+
+        const auto input = random_input();
+
+        const auto grown = session.grid().storage_allocations();
+        const auto before = utils::allocations();
+        const auto start = Clock::now();
+        session.tick(input);
+        result.ns += elapsed_ns(start);
+        const auto made = utils::allocations() - before;
+        const auto growth = session.grid().storage_allocations() - grown;
+        allocations += made - std::min(made, growth);
+    }
+    return result;
+}
+
+// Plays with random keys and a history, and every 64 ticks goes back a
+// random number of ticks, often past a keyframe. Only the rewinds are timed.
+// Fails when the grid isn't the one the game had back then, or when playing
+// the same keys again doesn't end up where the game was before rewinding.
+Result bench_rewind(const Size& size) {
+    std::optional<game::Session> session;
+    // inputs[t] was played on the grid with hashes[t]
+    std::vector<game::Input> inputs;
+    std::vector<uint64_t> hashes;
+
+    Result result;
+    result.iterations = std::min<uint64_t>(
+        iterations_for(game::SandGrid(size.width, size.height, shapes)), 200);
+
+    for (uint64_t i = 0; i < result.iterations; i++) {
+        if (!session.has_value() || session->is_over()) {
+            session.emplace(size.width, size.height, shapes,
+                            cfg::maskColors.size(), random.next());
+            session->keep_history(64 << 20);
+            inputs.clear();
+            hashes.assign(1, session->grid().hash());
+        }
+
+        for (int k = 0; k < 64 && !session->is_over(); k++) {
+            inputs.push_back(random_input());
+            session->tick(inputs.back());
+            hashes.push_back(session->grid().hash());
+        }
+
+        const auto start = Clock::now();
+        const uint64_t steps = session->rewind(random.below(200) + 1);
+        result.ns += elapsed_ns(start);
+
+        const size_t tick = hashes.size() - 1 - steps;
+        if (session->grid().hash() != hashes[tick]) {
+            throw std::runtime_error("rewind didn't restore the grid");
+        }
+        for (size_t t = tick; t < inputs.size(); t++) {
+            session->tick(inputs[t]);
+        }
+        if (session->grid().hash() != hashes.back()) {
+            throw std::runtime_error("a rewound game played on differently");
+        }
+    }
+    return result;
+}
+
+int replay(const std::string& path) {
+    const auto recording = game::Recording::load(path);
+    game::Session session(recording.width, recording.height, shapes,
+                          recording.palette, recording.seed);
+
+    const auto start = Clock::now();
+    recording.for_each_input(
+        [&session](const game::Input& input) { session.tick(input); });
+    const auto ns = elapsed_ns(start);
+    const auto hash = session.grid().hash();
+
+    std::cout << "ticks,total_ns,ticks_per_sec,hash" << std::endl;
+    std::cout << recording.ticks() << ',' << ns << ','
+              << recording.ticks() / (ns / 1e9) << ',' << std::hex << hash
+              << std::dec << std::endl;
+
+    if (recording.hash.has_value() && recording.hash.value() != hash) {
+        std::cerr << "the replay ended with hash " << std::hex << hash
+                  << " instead of " << recording.hash.value() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+}  // namespace
+
+void bench_board(const std::string& scenario, const game::SandGrid& board,
+                 utils::WorkerPool& pool) {
+    report(scenario, board, "update_sand",
+           bench_update(board, [](game::SandGrid& grid) {
+               grid.update_sand();
+           }));
+    report(scenario, board, "update_sand_bitwise",
+           bench_update(board, [](game::SandGrid& grid) {
+               grid.update_sand_bitwise();
+           }));
+    report(scenario, board, "update_sand_parallel",
+           bench_update(board, [&pool](game::SandGrid& grid) {
+               grid.update_sand_parallel(pool);
+           }));
+    report(scenario, board, "solids", bench_solids(board));
+    report(scenario, board, "find_areas", bench_find_areas(board));
+    report(scenario, board, "find_areas_incremental",
+           bench_find_areas_incremental(board));
+
+    const auto removed = bench_remove_areas(board);
+    if (removed.has_value()) {
+        report(scenario, board, "remove_areas", removed.value());
+    }
+
+    report(scenario, board, "snapshot_save", bench_snapshot_save(board));
+    report(scenario, board, "snapshot_load", bench_snapshot_load(board));
+}
+
+const char *const header =
+    "scenario,width,height,phase,iterations,total_ns,ns_per_cell,"
+    "ticks_per_sec,items_per_sec";
+
+int main(int argc, char *argv[]) try {
+    if (argc == 3 && std::string(argv[1]) == "--replay") {
+        return replay(argv[2]);
+    }
+
+    utils::WorkerPool pool;
+    std::cout << header << std::endl;
+
+    if (argc == 3 && std::string(argv[1]) == "--board") {
+        const auto session = game::Session::load(argv[2], shapes,
+                                                 cfg::maskColors.size());
+        bench_board(argv[2], session.grid(), pool);
+        return 0;
+    }
+
+    for (const auto& scenario : scenarios) {
+        for (const auto& size : sizes) {
+            game::SandGrid board(size.width, size.height, shapes);
+            scenario.fill(board);
+            bench_board(scenario.name, board, pool);
+        }
+    }
+
+    uint64_t allocations = 0;
+    for (const auto& size : sizes) {
+        const game::SandGrid board(size.width, size.height, shapes);
+        report("game", board, "tick", bench_ticks(size, allocations));
+        report("game", board, "rewind", bench_rewind(size));
+    }
+
+    if (allocations != 0) {
+        std::cerr << allocations << " allocations during game ticks"
+                  << std::endl;
+        return 1;
+    }
+} catch (const std::runtime_error& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+}
@@ -1,66 +1,492 @@
 #include "game.hpp"
 
+#include <algorithm>
 #include <cstdint>
-#include <set>
 #include <stdexcept>
 
+#include "profiler.hpp"
+
 namespace game {
 
+template <typename Coin>
+void SandGrid::update_span(uint32_t y, uint32_t cx, Coin& coin) noexcept {
+    if (y + 1 == height()) {
+        return;
+    }
+
+    const auto empty = [this](uint32_t cellX, uint32_t cellY) {
+        return !filledBits.test(cellX, cellY);
+    };
+
+    // Only grains of this span move from row y, so walking a copy of its
+    // bits visits every grain that is still there
+    const uint32_t word = cx * chunkSize / 64;
+    const uint64_t span = ((uint64_t(1) << chunkSize) - 1)
+                          << cx * chunkSize % 64;
+    for (uint64_t grains = sandBits.row(y)[word] & span; grains != 0;
+         grains &= grains - 1) {
+        const uint32_t x = word * 64 + __builtin_ctzll(grains);
+
+        uint32_t toX;
+        if (empty(x, y + 1)) {
+            toX = x;
+        } else if (x > 0 && empty(x - 1, y) && empty(x - 1, y + 1)) {
+            toX = x - 1;
+        } else if (x + 1 < width() && empty(x + 1, y) &&
+                   empty(x + 1, y + 1)) {
+            toX = x + 1;
+        } else {
+            // a grain with nowhere to go lets its chunk fall asleep
+            continue;
+        }
+
+        const bool goDown = coin();
+        if (!goDown) {
+            raisedChunks[cx + y / chunkSize * chunksX] |= 1 << 4;
+            continue;
+        }
+
+        move_grain(x, y, toX);
+    }
+}
+
 void SandGrid::update_sand() noexcept {
+    PROFILE_SCOPE(updateSand);
+    std::fill(raisedChunks.begin(), raisedChunks.end(), 0);
+
+    utils::CoinFlips coin(utils::Random(rng.next()));
     for (uint32_t y = height() - 1; y != static_cast<uint32_t>(-1); y--) {
-        for (uint32_t x = 0; x < width(); x++) {
-            auto& cell = at(x, y);
-            if (cell.state != GrainState::sand) {
-                continue;
+        const uint32_t cy = y / chunkSize;
+
+        for (uint32_t cx = 0; cx < chunksX; cx++) {
+            if (awakeChunks[cx + cy * chunksX]) {
+                update_span(y, cx, coin);
+            }
+        }
+    }
+
+    settle_chunks();
+}
+
+void SandGrid::update_sand_bitwise() noexcept {
+    PROFILE_SCOPE(updateSand);
+    static_assert(64 % chunkSize == 0);
+    std::fill(raisedChunks.begin(), raisedChunks.end(), 0);
+
+    utils::CoinFlips coin(utils::Random(rng.next()));
+    const uint32_t stride = sandBits.stride();
+    uint64_t *const down = moveScratch.data();
+    uint64_t *const left = down + stride;
+    uint64_t *const right = left + stride;
+
+    for (uint32_t y = height() - 2; y != static_cast<uint32_t>(-1); y--) {
+        const uint64_t *const sand = sandBits.row(y);
+        const uint64_t *const filled = filledBits.row(y);
+        const uint64_t *const below = filledBits.row(y + 1);
+        const uint32_t cy = y / chunkSize;
+
+        // cells a grain can slide through diagonally, bit x is set when both
+        // (x, y) and (x, y + 1) are empty
+        const auto free = [&](uint32_t k) -> uint64_t {
+            if (k >= stride) {
+                return 0;
+            }
+            return ~filled[k] & ~below[k] & sandBits.valid(k);
+        };
+
+        uint64_t carry = 0;
+        bool anyMoved = false;
+        for (uint32_t k = 0; k < stride; k++) {
+            uint64_t awake = 0;
+            for (uint32_t i = 0; i < 64 / chunkSize; i++) {
+                const uint32_t cx = k * (64 / chunkSize) + i;
+                if (cx < chunksX && awakeChunks[cx + cy * chunksX]) {
+                    awake |= ((uint64_t(1) << chunkSize) - 1) << i * chunkSize;
+                }
             }
 
-            utils::CellNeighbours others(*this, x, y);
-            if (others.bottom == nullptr) {
+            const uint64_t grains = sand[k] & awake;
+            if (grains == 0) {
+                down[k] = left[k] = right[k] = 0;
+                carry = 0;
                 continue;
             }
 
-            const bool goDown = std::rand() & 1;
-            if (!goDown) {
+            // bit x of toLeft is set when (x - 1) is free, toRight for x + 1
+            const uint64_t toLeft =
+                free(k) << 1 | (k > 0 ? free(k - 1) >> 63 : 0);
+            const uint64_t toRight = free(k) >> 1 | free(k + 1) << 63;
+
+            const uint64_t canDown = grains & ~below[k] & sandBits.valid(k);
+            const uint64_t canLeft = grains & ~canDown & toLeft;
+            const uint64_t canRight = grains & ~canDown & ~canLeft & toRight;
+            const uint64_t movable = canDown | canLeft | canRight;
+            const uint64_t flips = coin.word();
+
+            down[k] = canDown & flips;
+            right[k] = canRight & flips;
+            // a grain going right two cells to the left wins the cell
+            left[k] = canLeft & flips & ~(right[k] << 2 | carry);
+            carry = right[k] >> 62;
+
+            // grains that lost the coin flip keep their chunk awake
+            const uint64_t waiting = movable & ~(down[k] | left[k] | right[k]);
+            for (uint32_t i = 0; i < 64 / chunkSize; i++) {
+                const uint32_t cx = k * (64 / chunkSize) + i;
+                if (waiting >> i * chunkSize & ((1 << chunkSize) - 1)) {
+                    raisedChunks[cx + cy * chunksX] |= 1 << 4;
+                }
+            }
+            anyMoved |= (down[k] | left[k] | right[k]) != 0;
+        }
+
+        if (!anyMoved) {
+            continue;
+        }
+
+        for (uint32_t k = 0; k < stride; k++) {
+            const auto follow = [&](uint64_t moves, int32_t dx) {
+                for (; moves != 0; moves &= moves - 1) {
+                    const uint32_t x = k * 64 + __builtin_ctzll(moves);
+                    move_grain(x, y, x + dx);
+                }
+            };
+            follow(down[k], 0);
+            follow(left[k], -1);
+            follow(right[k], 1);
+        }
+    }
+
+    settle_chunks();
+}
+
+void SandGrid::update_tile(uint32_t tx, uint32_t ty, uint64_t seed) noexcept {
+    const uint32_t minCx = tx * tileChunks;
+    const uint32_t minCy = ty * tileChunks;
+    const uint32_t maxCx = std::min(chunksX, minCx + tileChunks);
+    const uint32_t maxCy = std::min(chunksY, minCy + tileChunks);
+
+    bool anyAwake = false;
+    for (uint32_t cy = minCy; cy < maxCy; cy++) {
+        for (uint32_t cx = minCx; cx < maxCx; cx++) {
+            anyAwake |= awakeChunks[cx + cy * chunksX];
+        }
+    }
+    if (!anyAwake) {
+        return;
+    }
+
+    utils::CoinFlips coin(utils::Random(seed, tx + ty * chunksX));
+    const uint32_t minY = minCy * chunkSize;
+    const uint32_t maxY = std::min(height(), maxCy * chunkSize);
+    for (uint32_t y = maxY - 1; y != minY - 1; y--) {
+        const uint32_t cy = y / chunkSize;
+
+        for (uint32_t cx = minCx; cx < maxCx; cx++) {
+            if (awakeChunks[cx + cy * chunksX]) {
+                update_span(y, cx, coin);
+            }
+        }
+    }
+}
+
+void SandGrid::update_sand_parallel(utils::WorkerPool& pool) noexcept {
+    PROFILE_SCOPE(updateSand);
+    std::fill(raisedChunks.begin(), raisedChunks.end(), 0);
+
+    const uint32_t tilesX = (chunksX + tileChunks - 1) / tileChunks;
+    const uint32_t tilesY = (chunksY + tileChunks - 1) / tileChunks;
+    const uint64_t seed = rng.next();
+
+    for (uint32_t phase = 0; phase < 4; phase++) {
+        const uint32_t px = phase % 2;
+        const uint32_t py = phase / 2;
+        const uint32_t countX = (tilesX - px + 1) / 2;
+        const uint32_t countY = (tilesY - py + 1) / 2;
+
+        auto job = [&](size_t i) {
+            const uint32_t tx = i % countX * 2 + px;
+            const uint32_t ty = i / countX * 2 + py;
+            update_tile(tx, ty, seed);
+        };
+        pool.run(countX * countY, job);
+    }
+
+    settle_chunks();
+}
+
+void SandGrid::move_grain(uint32_t x, uint32_t y, uint32_t toX) noexcept {
+    paint.move(x, y, toX, y + 1);
+
+    sandBits.assign(x, y, false);
+    filledBits.assign(x, y, false);
+    sandBits.assign(toX, y + 1, true);
+    filledBits.assign(toX, y + 1, true);
+
+    raise(x, y);
+    changedRows[x / chunkSize + y / chunkSize * chunksX] |= 3u
+                                                           << y % chunkSize;
+    PROFILE_COUNT(grainsMoved, 1);
+}
+
+Grain SandGrid::at(uint32_t x, uint32_t y) const {
+    const auto cell = paint.at(x, y);
+    const auto state = sandBits.test(x, y)     ? GrainState::sand
+                       : filledBits.test(x, y) ? GrainState::solid
+                                               : GrainState::empty;
+    return {state, static_cast<uint8_t>(cell), static_cast<uint8_t>(cell >> 8)};
+}
+
+void SandGrid::put(uint32_t x, uint32_t y, const Grain& grain) noexcept {
+    if (sandBits.test(x, y) || grain.state == GrainState::sand) {
+        dirtyRows[y] = 1;
+    }
+    rowRevisions[y] = ++revisionCount;
+
+    const bool empty = grain.state == GrainState::empty;
+    paint.set(x, y, empty ? 0 : grain.color << 8 | grain.mask);
+    sandBits.assign(x, y, grain.state == GrainState::sand);
+    filledBits.assign(x, y, !empty);
+}
+
+void SandGrid::set(uint32_t x, uint32_t y, const Grain& grain) {
+    if (x >= width() || y >= height()) {
+        throw std::runtime_error("Cell position out of bounds");
+    }
+    put(x, y, grain);
+    wake(x, y, 1, 1);
+}
+
+void SandGrid::raise(uint32_t x, uint32_t y) noexcept {
+    const uint32_t cx = x / chunkSize;
+    const uint32_t cy = y / chunkSize;
+    const int32_t minDx = x % chunkSize == 0 && x > 0 ? -1 : 0;
+    const int32_t maxDx = x % chunkSize == chunkSize - 1 && cx + 1 < chunksX;
+    const int32_t minDy = y % chunkSize == 0 && y > 0 ? -1 : 0;
+    const int32_t maxDy = y % chunkSize == chunkSize - 1 && cy + 1 < chunksY;
+
+    auto& raised = raisedChunks[cx + cy * chunksX];
+    for (int32_t dy = minDy; dy <= maxDy; dy++) {
+        for (int32_t dx = minDx; dx <= maxDx; dx++) {
+            raised |= 1 << ((dy + 1) * 3 + dx + 1);
+        }
+    }
+}
+
+void SandGrid::settle_chunks() noexcept {
+    // the paint of grains which left a chunk for good
+    paint.release_empty();
+    std::fill(awakeChunks.begin(), awakeChunks.end(), 0);
+
+    for (uint32_t cy = 0; cy < chunksY; cy++) {
+        for (uint32_t cx = 0; cx < chunksX; cx++) {
+            const auto raised = raisedChunks[cx + cy * chunksX];
+            if (raised == 0) {
                 continue;
             }
 
-            if (others.bottom->state == GrainState::empty) {
-                *others.bottom = cell;
-                cell.state = GrainState::empty;
-            } else if (others.left != nullptr &&
-                       others.left->state == GrainState::empty &&
-                       others.bottomLeft->state == GrainState::empty) {
-                *others.bottomLeft = cell;
-                cell.state = GrainState::empty;
-            } else if (others.right != nullptr &&
-                       others.right->state == GrainState::empty &&
-                       others.bottomRight->state == GrainState::empty) {
-                *others.bottomRight = cell;
-                cell.state = GrainState::empty;
-                x++;
+            for (uint32_t bit = 0; bit < 9; bit++) {
+                if (raised & 1 << bit) {
+                    const uint32_t nx = cx + bit % 3 - 1;
+                    const uint32_t ny = cy + bit / 3 - 1;
+                    awakeChunks[nx + ny * chunksX] = 1;
+                }
+            }
+        }
+    }
+
+    // a grain leaving the last row of a chunk lands in the next one
+    revisionCount++;
+    for (uint32_t cy = 0; cy < chunksY; cy++) {
+        for (uint32_t cx = 0; cx < chunksX; cx++) {
+            auto& changed = changedRows[cx + cy * chunksX];
+            for (; changed != 0; changed &= changed - 1) {
+                const uint32_t y = cy * chunkSize + __builtin_ctz(changed);
+                dirtyRows[y] = 1;
+                rowRevisions[y] = revisionCount;
             }
         }
     }
 }
 
-void SandGrid::place_solid(const Solid& solid) {
-    currentSolid.emplace(solid);
+void SandGrid::wake(uint32_t x, uint32_t y, uint32_t w, uint32_t h) noexcept {
+    const uint32_t minCx = (x > 0 ? x - 1 : 0) / chunkSize;
+    const uint32_t minCy = (y > 0 ? y - 1 : 0) / chunkSize;
+    const uint32_t maxCx = std::min(x + w, width() - 1) / chunkSize;
+    const uint32_t maxCy = std::min(y + h, height() - 1) / chunkSize;
 
-    for (uint32_t y = 0; y < solid.texture.height(); y++) {
-        for (uint32_t x = 0; x < solid.texture.width(); x++) {
-            const uint8_t pixel = solid.texture.at(x, y) & 0xFF;
+    for (uint32_t cy = minCy; cy <= maxCy; cy++) {
+        for (uint32_t cx = minCx; cx <= maxCx; cx++) {
+            awakeChunks[cx + cy * chunksX] = 1;
+        }
+    }
+}
+
+void SandGrid::erase(uint32_t x, uint32_t y, uint32_t w) {
+    if (x + w > width() || y >= height()) {
+        throw std::runtime_error("Cell position out of bounds");
+    }
+
+    for (uint32_t i = x; i < x + w; i++) {
+        put(i, y, Grain::empty());
+    }
+    wake(x, y, w, 1);
+}
+
+uint32_t SandGrid::packed_at(uint32_t x, uint32_t y) const noexcept {
+    const auto state = sandBits.test(x, y)     ? GrainState::sand
+                       : filledBits.test(x, y) ? GrainState::solid
+                                               : GrainState::empty;
+    return static_cast<uint32_t>(state) << 16 | paint.get(x, y);
+}
+
+void SandGrid::packed_row(uint32_t y, uint32_t *out) const noexcept {
+    for (uint32_t x = 0; x < width(); x++) {
+        out[x] = packed_at(x, y);
+    }
+}
+
+void SandGrid::set_packed_row(uint32_t y, const uint32_t *cells) noexcept {
+    for (uint32_t x = 0; x < width(); x++) {
+        if (cells[x] != packed_at(x, y)) {
+            put(x, y, {static_cast<GrainState>(cells[x] >> 16),
+                       static_cast<uint8_t>(cells[x]),
+                       static_cast<uint8_t>(cells[x] >> 8)});
+            wake(x, y, 1, 1);
+        }
+    }
+}
+
+void SandGrid::restore(const std::optional<Solid>& solid,
+                       uint64_t randomState,
+                       const std::vector<uint8_t>& awake) noexcept {
+    currentSolid = solid;
+    rng = utils::Random(randomState);
+    std::copy(awake.begin(), awake.end(), awakeChunks.begin());
+}
+
+void ShapeRegistry::add(const uint32_t *pixels, uint32_t width,
+                        uint32_t height) {
+    if (width > maxSize || height > maxSize) {
+        throw std::runtime_error("Mask is too large");
+    }
+
+    Shape shape{utils::Grid<uint32_t>(width, height),
+                std::vector<uint64_t>(height, 0),
+                std::vector<uint64_t>(height + 2, 0),
+                width,
+                height,
+                0,
+                0};
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t pixel = pixels[x + y * width];
+            shape.pixels.row(y)[x] = pixel;
             if (pixel == 0) {
                 continue;
             }
 
-            auto& grain = at(solid.x + x, solid.y + y);
-            if (grain.state != GrainState::empty) {
-                throw game_over_error();
-            }
+            shape.occupancy[y] |= uint64_t(1) << x;
+            shape.minX = std::min(shape.minX, x);
+            shape.minY = std::min(shape.minY, y);
+            shape.maxX = std::max(shape.maxX, x + 1);
+            shape.maxY = std::max(shape.maxY, y + 1);
+        }
+    }
+    if (shape.maxX == 0) {
+        throw std::runtime_error("Mask has no opaque pixels");
+    }
 
-            grain = {GrainState::solid, pixel, solid.color};
+    for (uint32_t y = 0; y < height; y++) {
+        const uint64_t row = shape.occupancy[y] << 1;
+        shape.contact[y] |= row;
+        shape.contact[y + 1] |= row | row << 1 | row >> 1;
+        shape.contact[y + 2] |= row;
+    }
+
+    shapes.push_back(std::move(shape));
+}
+
+ShapeRegistry::ShapeRegistry(
+    const std::vector<utils::PostProcessedTexture>& masks) {
+    shapes.reserve(masks.size() * rotations);
+
+    for (const auto& mask : masks) {
+        auto texture = mask;
+        for (uint8_t rotation = 0; rotation < rotations; rotation++) {
+            add(texture.row(0), texture.width(), texture.height());
+            texture = texture.ror();
+        }
+    }
+}
+
+ShapeRegistry::ShapeRegistry(const assets::Image *images, size_t count) {
+    if (count % rotations != 0) {
+        throw std::runtime_error("Mask is missing rotations");
+    }
+    shapes.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+        add(images[i].pixels, images[i].width, images[i].height);
+    }
+}
+
+size_t SandGrid::storage_bytes() const noexcept {
+    // both bitboards
+    size_t bytes = 2 * sizeof(uint64_t) * sandBits.stride() * height();
+    bytes += paint.capacity_bytes();
+    bytes += areaRuns.capacity() * sizeof(areaRuns[0]);
+    for (const auto& runs : areaRuns) {
+        bytes += runs.capacity() * sizeof(AreaRun);
+    }
+    bytes += spanningRuns.capacity() * sizeof(RunRef);
+    return bytes;
+}
+
+uint64_t SandGrid::hash() const noexcept {
+    uint64_t hash = utils::Random::mix(width() ^ uint64_t(height()) << 32);
+    const auto add = [&hash](uint64_t value) {
+        hash = utils::Random::mix(hash ^ value);
+    };
+
+    for (uint32_t y = 0; y < height(); y++) {
+        for (uint32_t k = 0; k < sandBits.stride(); k++) {
+            add(sandBits.row(y)[k]);
+            add(filledBits.row(y)[k]);
+        }
+        for (uint32_t x = 0; x < width(); x++) {
+            add(paint.get(x, y));
+        }
+    }
+    return hash;
+}
+
+void SandGrid::place_solid(const Solid& solid) {
+    const auto& shape = shape_of(solid);
+    if (solid.x + shape.maxX > width() || solid.y + shape.maxY > height()) {
+        throw std::runtime_error("Solid position out of bounds");
+    }
+    currentSolid.emplace(solid);
+
+    for (uint32_t y = shape.minY; y < shape.maxY; y++) {
+        if (filledBits.window(solid.x, solid.y + y) & shape.occupancy[y]) {
+            throw game_over_error();
         }
     }
+
+    for (uint32_t y = shape.minY; y < shape.maxY; y++) {
+        const uint32_t *const pixels = shape.pixels.row(y);
+        for (uint64_t bits = shape.occupancy[y]; bits != 0;
+             bits &= bits - 1) {
+            const uint32_t x = __builtin_ctzll(bits);
+            put(solid.x + x, solid.y + y,
+                {GrainState::solid, static_cast<uint8_t>(pixels[x] & 0xFF),
+                 solid.color});
+        }
+    }
+
+    wake(solid.x + shape.minX, solid.y + shape.minY, shape.maxX - shape.minX,
+         shape.maxY - shape.minY);
 }
 
 void SandGrid::remove_current_solid() {
@@ -69,22 +495,30 @@ void SandGrid::remove_current_solid() {
             "trying to remove a solid when there are none");
     }
 
-    for (uint32_t y = 0; y < currentSolid->texture.height(); y++) {
-        for (uint32_t x = 0; x < currentSolid->texture.width(); x++) {
-            if (currentSolid->texture.at(x, y) == 0) {
+    const auto& shape = shape_of(*currentSolid);
+    for (uint32_t y = shape.minY; y < shape.maxY; y++) {
+        const uint32_t *const pixels = shape.pixels.row(y);
+        for (uint32_t x = shape.minX; x < shape.maxX; x++) {
+            if (pixels[x] == 0) {
                 continue;
             }
-            at(currentSolid->x + x, currentSolid->y + y) = Grain::empty();
+            put(currentSolid->x + x, currentSolid->y + y, Grain::empty());
         }
     }
+
+    // sand resting on the solid may fall now
+    wake(currentSolid->x + shape.minX, currentSolid->y + shape.minY,
+         shape.maxX - shape.minX, shape.maxY - shape.minY);
     currentSolid.reset();
 }
 
 void SandGrid::move_current_solid(Direction direction) {
+    PROFILE_SCOPE(moveSolid);
     if (!currentSolid.has_value()) {
         throw std::runtime_error("trying to move a solid when there are none");
     }
 
+    const auto& shape = shape_of(*currentSolid);
     auto newX = currentSolid->x;
     auto newY = currentSolid->y;
 
@@ -95,7 +529,7 @@ void SandGrid::move_current_solid(Direction direction) {
             }
             break;
         case Direction::right:
-            if (currentSolid->x + currentSolid->texture.width() != width()) {
+            if (currentSolid->x + shape.maxX < width()) {
                 newX++;
             }
             break;
@@ -105,7 +539,7 @@ void SandGrid::move_current_solid(Direction direction) {
             }
             break;
         case Direction::down:
-            if (currentSolid->y + currentSolid->texture.height() != height()) {
+            if (currentSolid->y + shape.maxY < height()) {
                 newY++;
             }
             break;
@@ -118,23 +552,17 @@ void SandGrid::move_current_solid(Direction direction) {
     place_solid(solid);
 }
 
-static bool does_solid_fit(const SandGrid& grid, const Solid& solid) noexcept {
-    for (uint32_t y = 0; y < solid.texture.height(); y++) {
-        for (uint32_t x = 0; x < solid.texture.width(); x++) {
-            if (solid.texture.at(x, y) == 0) {
-                continue;
-            }
-
-            if (solid.x + x >= grid.width() || solid.y + y >= grid.height()) {
-                return false;
-            }
+bool SandGrid::does_solid_fit(const Solid& solid) const noexcept {
+    const auto& shape = shape_of(solid);
+    if (solid.x + shape.maxX > width() || solid.y + shape.maxY > height()) {
+        return false;
+    }
 
-            if (grid.at(solid.x + x, solid.y + y).state == GrainState::sand) {
-                return false;
-            }
+    for (uint32_t y = shape.minY; y < shape.maxY; y++) {
+        if (sandBits.window(solid.x, solid.y + y) & shape.occupancy[y]) {
+            return false;
         }
     }
-
     return true;
 }
 
@@ -144,9 +572,9 @@ void SandGrid::rotate_current_solid() {
     }
 
     auto solid = currentSolid.value();
-    solid.texture = solid.texture.ror();
+    solid.rotation = (solid.rotation + 1) % ShapeRegistry::rotations;
 
-    if (does_solid_fit(*this, solid)) {
+    if (does_solid_fit(solid)) {
         remove_current_solid();
         place_solid(solid);
     }
@@ -157,30 +585,23 @@ bool SandGrid::does_current_solid_collide() const {
         throw std::runtime_error("trying to check a solid when there are none");
     }
 
-    if (currentSolid->y + currentSolid->texture.height() == height()) {
+    const auto& shape = shape_of(*currentSolid);
+    if (currentSolid->y + shape.maxY == height()) {
         return true;
     }
 
-    for (uint32_t y = 0; y < currentSolid->texture.height(); y++) {
-        for (uint32_t x = 0; x < currentSolid->texture.width(); x++) {
-            if (currentSolid->texture.at(x, y) == 0) {
-                continue;
-            }
-            // const_cast is safe here because data is never modified
-            const utils::CellNeighbours others(const_cast<SandGrid&>(*this),
-                                               currentSolid->x + x,
-                                               currentSolid->y + y);
-
-            if ((others.left != nullptr &&
-                 others.left->state == GrainState::sand) ||
-                (others.right != nullptr &&
-                 others.right->state == GrainState::sand) ||
-                (others.top != nullptr &&
-                 others.top->state == GrainState::sand) ||
-                (others.bottom != nullptr &&
-                 others.bottom->state == GrainState::sand)) {
-                return true;
-            }
+    // the contact mask starts a row above and a column left of the solid
+    for (uint32_t y = shape.minY; y < shape.maxY + 2; y++) {
+        const uint32_t gy = currentSolid->y + y - 1;
+        if (gy >= height()) {
+            continue;
+        }
+
+        const uint64_t sand =
+            currentSolid->x == 0 ? sandBits.window(0, gy) << 1
+                                 : sandBits.window(currentSolid->x - 1, gy);
+        if (sand & shape.contact[y]) {
+            return true;
         }
     }
     return false;
@@ -192,86 +613,236 @@ void SandGrid::convert_current_solid_to_sand() {
             "trying to convert a solid when there are none");
     }
 
-    for (uint32_t y = 0; y < currentSolid->texture.height(); y++) {
-        for (uint32_t x = 0; x < currentSolid->texture.width(); x++) {
-            if (currentSolid->texture.at(x, y) == 0) {
+    const auto& shape = shape_of(*currentSolid);
+    for (uint32_t y = shape.minY; y < shape.maxY; y++) {
+        const uint32_t *const pixels = shape.pixels.row(y);
+        for (uint32_t x = shape.minX; x < shape.maxX; x++) {
+            if (pixels[x] == 0) {
                 continue;
             }
-            at(currentSolid->x + x, currentSolid->y + y).state =
-                GrainState::sand;
+            auto grain = at(currentSolid->x + x, currentSolid->y + y);
+            grain.state = GrainState::sand;
+            put(currentSolid->x + x, currentSolid->y + y, grain);
         }
     }
+
+    wake(currentSolid->x + shape.minX, currentSolid->y + shape.minY,
+         shape.maxX - shape.minX, shape.maxY - shape.minY);
 }
 
-static bool does_area_hit_right_border(
-    const SandGrid& grid, uint32_t color, uint32_t x, uint32_t y,
-    std::set<std::pair<uint32_t, uint32_t>>& checked) noexcept {
-    if (x >= grid.width() || y >= grid.height()) {
-        return false;
+// Calls f(x0, x1, color) for every run of same colored sand in row y
+template <typename F>
+static void for_each_run(const SandGrid& grid, uint32_t y, F&& f) {
+    const auto& sand = grid.sand_bits();
+    const uint64_t *const bits = sand.row(y);
+    const auto color_at = [&grid, y](uint32_t x) -> uint8_t {
+        return grid.paint_at(x, y) >> 8;
+    };
+
+    for (uint32_t k = 0; k < sand.stride(); k++) {
+        for (uint64_t word = bits[k]; word != 0;) {
+            const uint32_t x0 = k * 64 + __builtin_ctzll(word);
+            const uint8_t color = color_at(x0);
+            uint32_t x1 = x0;
+            while (x1 + 1 < grid.width() && sand.test(x1 + 1, y) &&
+                   color_at(x1 + 1) == color) {
+                x1++;
+            }
+
+            f(x0, x1, color);
+
+            if (x1 / 64 != k) {
+                k = x1 / 64;
+                word = bits[k];
+            }
+            word &= x1 % 64 == 63 ? 0 : ~uint64_t(0) << (x1 % 64 + 1);
+        }
     }
+}
 
-    const auto& cell = grid.at(x, y);
-    if (checked.insert({x, y}).second == false ||
-        cell.state != GrainState::sand || cell.color != color) {
-        return false;
+void SandGrid::scan_row(uint32_t y) {
+    auto& runs = areaRuns[y];
+    runs.clear();
+    for_each_run(*this, y, [&](uint32_t x0, uint32_t x1, uint8_t color) {
+        push_run(runs, {x0, x1, color, 0});
+    });
+    PROFILE_COUNT(cellsScanned, width());
+}
+
+// Visits the whole area of start and appends its runs to spanningRuns when
+// it touches both walls
+bool SandGrid::walk_area(RunRef start) {
+    const size_t first = spanningRuns.size();
+    uint8_t walls = 0;
+
+    row_runs(start.y)[start.i].visit = areaVisit;
+    push_run(spanningRuns, start);
+    for (size_t next = first; next < spanningRuns.size(); next++) {
+        const auto ref = spanningRuns[next];
+        const auto run = row_runs(ref.y)[ref.i];
+        walls |= (run.x0 == 0) | (run.x1 == width() - 1) << 1;
+
+        const auto left_of_run = [&run](const AreaRun& other) {
+            return other.x1 + 1 < run.x0;
+        };
+
+        for (const uint32_t ny : {ref.y - 1, ref.y + 1}) {
+            if (ny >= height()) {
+                continue;
+            }
+
+            // runs of a row are sorted, so the ones touching this run, also
+            // diagonally, follow each other
+            AreaRun *const begin = row_runs(ny);
+            AreaRun *const end = begin + areaRuns[ny].size();
+            for (auto it = std::partition_point(begin, end, left_of_run);
+                 it != end && it->x0 <= run.x1 + 1; ++it) {
+                if (it->color == run.color && it->visit != areaVisit) {
+                    it->visit = areaVisit;
+                    push_run(spanningRuns,
+                             {ny, static_cast<uint32_t>(it - begin)});
+                }
+            }
+        }
     }
 
-    return x == grid.width() - 1 ||
-           does_area_hit_right_border(grid, color, x + 1, y, checked) ||
-           does_area_hit_right_border(grid, color, x, y + 1, checked) ||
-           does_area_hit_right_border(grid, color, x, y - 1, checked) ||
-           does_area_hit_right_border(grid, color, x - 1, y - 1, checked) ||
-           does_area_hit_right_border(grid, color, x + 1, y - 1, checked) ||
-           does_area_hit_right_border(grid, color, x - 1, y + 1, checked) ||
-           does_area_hit_right_border(grid, color, x + 1, y + 1, checked);
+    if (walls != 3) {
+        spanningRuns.resize(first);
+        return false;
+    }
+    return true;
 }
 
-std::optional<uint32_t> get_any_area_id(const SandGrid& grid) noexcept {
-    std::optional<uint32_t> currentColor;
+size_t SandGrid::find_areas() {
+    PROFILE_SCOPE(findAreas);
+    spanningRuns.clear();
+    areaVisit++;
 
-    for (uint32_t y = 0; y < grid.height(); y++) {
-        const auto& cell = grid.at(0, y);
-        if (cell.state != GrainState::sand || currentColor == cell.color) {
+    for (uint32_t y = 0; y < height(); y++) {
+        if (dirtyRows[y]) {
+            scan_row(y);
+            dirtyRows[y] = 2;
+        }
+    }
+
+    // every area that changed reaches a scanned row
+    size_t found = 0;
+    for (uint32_t y = 0; y < height(); y++) {
+        if (dirtyRows[y] != 2) {
             continue;
         }
+        dirtyRows[y] = 0;
 
-        std::set<std::pair<uint32_t, uint32_t>> checked;
-        if (does_area_hit_right_border(grid, cell.color, 0, y, checked)) {
-            return y;
+        for (uint32_t i = 0; i < areaRuns[y].size(); i++) {
+            if (row_runs(y)[i].visit != areaVisit) {
+                found += walk_area({y, i});
+            }
         }
+    }
+
+    // areas left in place have to be found again next time
+    for (const auto& ref : spanningRuns) {
+        dirtyRows[ref.y] = 1;
+    }
+    return found;
+}
 
-        currentColor.emplace(cell.color);
+unsigned SandGrid::remove_areas() {
+    PROFILE_SCOPE(removeAreas);
+    unsigned removed = 0;
+    for (const auto& ref : spanningRuns) {
+        const auto run = row_runs(ref.y)[ref.i];
+        erase(run.x0, ref.y, run.x1 - run.x0 + 1);
+        removed += run.x1 - run.x0 + 1;
     }
 
-    return std::nullopt;
+    spanningRuns.clear();
+    return removed;
 }
 
-static unsigned rm_area(SandGrid& grid, uint32_t color, uint32_t x,
-                        uint32_t y) noexcept {
-    if (x >= grid.width() || y >= grid.height()) {
-        return 0;
+uint32_t AreaFinder::root(uint32_t run) noexcept {
+    while (parents[run] != run) {
+        parents[run] = parents[parents[run]];
+        run = parents[run];
     }
+    return run;
+}
 
-    auto& cell = grid.at(x, y);
-    if (cell.state == GrainState::empty || cell.color != color) {
-        return 0;
+void AreaFinder::join(uint32_t a, uint32_t b) noexcept {
+    a = root(a);
+    b = root(b);
+    if (a < b) {
+        parents[b] = a;
+    } else {
+        parents[a] = b;
+    }
+}
+
+size_t AreaFinder::find(const SandGrid& grid) {
+    runs.clear();
+    parents.clear();
+    spanning.clear();
+
+    uint32_t previous = 0;
+
+    for (uint32_t y = 0; y < grid.height(); y++) {
+        const uint32_t current = runs.size();
+        for_each_run(grid, y, [&](uint32_t x0, uint32_t x1, uint8_t color) {
+            runs.push_back({y, x0, x1, color});
+            parents.push_back(runs.size() - 1);
+        });
+
+        // join with every run of the row above that touches this one, also
+        // diagonally
+        uint32_t first = previous;
+        for (uint32_t j = current; j < runs.size(); j++) {
+            const auto& run = runs[j];
+            while (first < current && runs[first].x1 + 1 < run.x0) {
+                first++;
+            }
+
+            for (uint32_t i = first; i < current && runs[i].x0 <= run.x1 + 1;
+                 i++) {
+                if (runs[i].color == run.color) {
+                    join(i, j);
+                }
+            }
+        }
+        previous = current;
+    }
+
+    walls.assign(runs.size(), 0);
+    for (uint32_t i = 0; i < runs.size(); i++) {
+        walls[root(i)] |= (runs[i].x0 == 0) |
+                          (runs[i].x1 == grid.width() - 1) << 1;
+    }
+
+    for (uint32_t i = 0; i < runs.size(); i++) {
+        if (parents[i] == i && walls[i] == 3) {
+            spanning.push_back(i);
+        }
     }
-    cell.state = GrainState::empty;
 
-    return rm_area(grid, color, x + 1, y) + rm_area(grid, color, x, y + 1) +
-           rm_area(grid, color, x, y - 1) + rm_area(grid, color, x - 1, y - 1) +
-           rm_area(grid, color, x + 1, y - 1) +
-           rm_area(grid, color, x - 1, y + 1) +
-           rm_area(grid, color, x + 1, y + 1) + 1;
+    return spanning.size();
 }
 
-unsigned remove_area(SandGrid& grid, uint32_t id) {
-    const auto& cell = grid.at(0, id);
-    if (cell.state != GrainState::sand) {
-        throw std::runtime_error("Trying to remove a non-sand area");
+unsigned AreaFinder::remove(SandGrid& grid) {
+    if (spanning.empty()) {
+        return 0;
+    }
+
+    unsigned removed = 0;
+    for (uint32_t i = 0; i < runs.size(); i++) {
+        if (walls[root(i)] != 3) {
+            continue;
+        }
+
+        grid.erase(runs[i].x0, runs[i].y, runs[i].x1 - runs[i].x0 + 1);
+        removed += runs[i].x1 - runs[i].x0 + 1;
     }
 
-    return rm_area(grid, cell.color, 0, id);
+    spanning.clear();
+    return removed;
 }
 
 }  // namespace game
@@ -0,0 +1,211 @@
+#include "history.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "binary.hpp"
+
+namespace game {
+
+// Entries start with the awake chunks, which are one long row, followed by
+// the rows of the grid. A grid row starts with the number of rows skipped
+// since the last one as LEB128. Every row is made of runs until it is full:
+// the length of a run of zeros, then the length of a run of other values
+// followed by the values.
+template <typename T>
+static void encode_row(std::string& out, const T *old, const T *cells,
+                       uint32_t width) {
+    const auto diff = [&](uint32_t x) -> uint32_t {
+        return old == nullptr ? cells[x] : old[x] ^ cells[x];
+    };
+
+    for (uint32_t x = 0;;) {
+        uint32_t end = x;
+        while (end < width && diff(end) == 0) {
+            end++;
+        }
+        utils::append_varint(out, end - x);
+        x = end;
+        if (x == width) {
+            break;
+        }
+
+        while (end < width && diff(end) != 0) {
+            end++;
+        }
+        utils::append_varint(out, end - x);
+        for (; x < end; x++) {
+            utils::append_varint(out, diff(x));
+        }
+        if (x == width) {
+            break;
+        }
+    }
+}
+
+// XORs a row written by encode_row into cells
+template <typename T>
+static void decode_row(const char *&in, T *cells, uint32_t width) noexcept {
+    for (uint32_t x = 0;;) {
+        x += static_cast<uint32_t>(utils::read_varint(in));
+        if (x == width) {
+            break;
+        }
+        const auto count = utils::read_varint(in);
+        for (uint64_t i = 0; i < count; i++, x++) {
+            cells[x] ^= static_cast<T>(utils::read_varint(in));
+        }
+        if (x == width) {
+            break;
+        }
+    }
+}
+
+static size_t cost(const std::string& delta, const std::string& cells) {
+    return delta.capacity() + cells.capacity();
+}
+
+History::History(const SandGrid& grid, const TickState& state,
+                 size_t budget, uint32_t interval)
+    : width(grid.width()),
+      height(grid.height()),
+      maxBytes(budget),
+      keyframeInterval(std::max<uint32_t>(interval, 1)),
+      shadow(static_cast<size_t>(width) * height, 0),
+      awake(grid.awake_chunks().size(), 0),
+      // every row has a revision above it
+      revision(0),
+      row(width),
+      touched(height) {
+    add(grid, state, true);
+}
+
+void History::add(const SandGrid& grid, const TickState& state,
+                  bool keyframe) {
+    const auto& chunks = grid.awake_chunks();
+    buffer.clear();
+    const auto count = static_cast<uint32_t>(awake.size());
+    encode_row(buffer, awake.data(), chunks.data(), count);
+    std::copy(chunks.begin(), chunks.end(), awake.begin());
+
+    uint32_t next = 0;
+    for (uint32_t y = 0; y < height; y++) {
+        if (grid.row_revision(y) <= revision) {
+            continue;
+        }
+        uint32_t *const old = shadow.data() + static_cast<size_t>(y) * width;
+        grid.packed_row(y, row.data());
+        if (!std::equal(row.begin(), row.end(), old)) {
+            utils::append_varint(buffer, y - next);
+            encode_row(buffer, old, row.data(), width);
+            std::copy(row.begin(), row.end(), old);
+            next = y + 1;
+        }
+    }
+    revision = grid.revision();
+
+    entries.push_back({state, buffer, keyframe, {}});
+    auto& entry = entries.back();
+    if (keyframe) {
+        buffer.clear();
+        encode_row<uint8_t>(buffer, nullptr, awake.data(), count);
+        next = 0;
+        for (uint32_t y = 0; y < height; y++) {
+            const uint32_t *const cells =
+                shadow.data() + static_cast<size_t>(y) * width;
+            if (std::any_of(cells, cells + width,
+                            [](uint32_t cell) { return cell != 0; })) {
+                utils::append_varint(buffer, y - next);
+                encode_row<uint32_t>(buffer, nullptr, cells, width);
+                next = y + 1;
+            }
+        }
+        entry.cells = buffer;
+    }
+    bytes += sizeof(Entry) + cost(entry.delta, entry.cells);
+}
+
+void History::apply(const std::string& rows) noexcept {
+    const char *in = rows.data();
+    const char *const end = in + rows.size();
+    decode_row(in, awake.data(), static_cast<uint32_t>(awake.size()));
+    for (uint32_t y = 0; in != end; y++) {
+        y += static_cast<uint32_t>(utils::read_varint(in));
+        touched[y] = 1;
+        decode_row(in, shadow.data() + static_cast<size_t>(y) * width, width);
+    }
+}
+
+bool History::drop_oldest() noexcept {
+    const auto next =
+        std::find_if(entries.begin() + 1, entries.end(),
+                     [](const Entry& entry) { return entry.keyframe; });
+    if (next == entries.end()) {
+        return false;
+    }
+    for (auto it = entries.begin(); it != next; ++it) {
+        bytes -= sizeof(Entry) + cost(it->delta, it->cells);
+    }
+    entries.erase(entries.begin(), next);
+    return true;
+}
+
+void History::push(const SandGrid& grid, const TickState& state) {
+    const bool keyframe = ++sinceKeyframe == keyframeInterval;
+    if (keyframe) {
+        sinceKeyframe = 0;
+    }
+    add(grid, state, keyframe);
+
+    // the newest keyframe and the entries after it always stay
+    while (bytes > maxBytes && drop_oldest()) {
+    }
+}
+
+uint64_t History::rewind(SandGrid& grid, uint64_t ticks) {
+    const uint64_t steps = std::min(ticks, depth());
+    const size_t target = entries.size() - 1 - steps;
+    // the oldest entry is always a keyframe
+    size_t keyframe = target;
+    while (!entries[keyframe].keyframe) {
+        keyframe--;
+    }
+
+    std::fill(touched.begin(), touched.end(), 0);
+    if (steps <= target - keyframe) {
+        // XOR undoes itself
+        for (size_t i = entries.size() - 1; i > target; i--) {
+            apply(entries[i].delta);
+        }
+    } else {
+        std::fill(shadow.begin(), shadow.end(), 0);
+        std::fill(awake.begin(), awake.end(), 0);
+        std::fill(touched.begin(), touched.end(), 1);
+        apply(entries[keyframe].cells);
+        for (size_t i = keyframe + 1; i <= target; i++) {
+            apply(entries[i].delta);
+        }
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        if (touched[y]) {
+            grid.set_packed_row(
+                y, shadow.data() + static_cast<size_t>(y) * width);
+        }
+    }
+
+    while (entries.size() > target + 1) {
+        bytes -= sizeof(Entry) +
+                 cost(entries.back().delta, entries.back().cells);
+        entries.pop_back();
+    }
+    sinceKeyframe = static_cast<uint32_t>(target - keyframe);
+
+    grid.restore(state().currentSolid, state().random, awake);
+    revision = grid.revision();
+    return steps;
+}
+
+}  // namespace game
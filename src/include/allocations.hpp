@@ -0,0 +1,15 @@
+#ifndef ALLOCATIONSHPP
+#define ALLOCATIONSHPP
+
+#include <cstdint>
+
+namespace utils {
+
+// Number of times the global operator new has been called so far. Counting
+// is opt-in: it is defined in allocations.cpp next to the replaced
+// operators, so only programs linking that file can use it.
+uint64_t allocations() noexcept;
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef ASSETSHPP
+#define ASSETSHPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Images from the assets directory, baked into the executable at build time
+// by tetrisand_bake (src/tools/bake.cpp). The definitions live in the
+// generated assets.cpp.
+namespace assets {
+
+struct Image {
+    uint32_t width;
+    uint32_t height;
+    // 0xRRGGBB, row after row
+    const uint32_t *pixels;
+};
+
+// Every mask in all of game::ShapeRegistry::rotations rotations, one after
+// the other, already shaded by cfg::shader
+extern const Image masks[];
+extern const size_t maskCount;
+
+// the digits 0 to 9 as they are in the files
+extern const Image digits[10];
+
+}  // namespace assets
+
+#endif
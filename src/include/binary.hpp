@@ -0,0 +1,81 @@
+#ifndef BINARYHPP
+#define BINARYHPP
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+namespace utils {
+
+// Little endian numbers and LEB128 varints of the binary file formats. The
+// appending versions build a buffer which is written at once.
+
+inline void write_le(std::ostream& out, uint64_t value, int bytes = 8) {
+    for (int i = 0; i < bytes; i++) {
+        out.put(static_cast<char>(value >> i * 8 & 0xFF));
+    }
+}
+
+inline void append_le(std::string& out, uint64_t value, int bytes = 8) {
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(static_cast<char>(value >> i * 8 & 0xFF));
+    }
+}
+
+// straight from the stream's buffer, which is a lot faster than get()
+inline uint64_t read_le(std::istream& in, int bytes = 8) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        const int byte = in.rdbuf()->sbumpc();
+        if (byte == std::istream::traits_type::eof()) {
+            throw std::runtime_error("file is cut short");
+        }
+        value |= static_cast<uint64_t>(byte) << i * 8;
+    }
+    return value;
+}
+
+inline void write_varint(std::ostream& out, uint64_t value) {
+    for (; value >= 0x80; value >>= 7) {
+        out.put(static_cast<char>((value & 0x7F) | 0x80));
+    }
+    out.put(static_cast<char>(value));
+}
+
+inline void append_varint(std::string& out, uint64_t value) {
+    for (; value >= 0x80; value >>= 7) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline uint64_t read_varint(std::istream& in) {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        const uint64_t byte = read_le(in, 1);
+        value |= (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error("varint is too long");
+}
+
+// Same for a buffer built by append_varint, in is moved past the varint. The
+// buffer has to end with a whole varint.
+inline uint64_t read_varint(const char *&in) noexcept {
+    uint64_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        const auto byte = static_cast<uint8_t>(*in++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef BITGRIDHPP
+#define BITGRIDHPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+
+// One bit per cell. Every row starts on a fresh 64 bit word and bit x % 64 of
+// word x / 64 belongs to column x, the padding bits of a row are always zero.
+class BitGrid {
+    std::vector<uint64_t> m_words;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_stride;
+
+public:
+    BitGrid(uint32_t width, uint32_t height) noexcept
+        : m_words(static_cast<size_t>((width + 63) / 64) * height, 0),
+          m_width(width),
+          m_height(height),
+          m_stride((width + 63) / 64) {}
+
+    uint32_t width() const noexcept { return m_width; }
+    uint32_t height() const noexcept { return m_height; }
+    // words per row
+    uint32_t stride() const noexcept { return m_stride; }
+
+    const uint64_t *row(uint32_t y) const noexcept {
+        return m_words.data() + static_cast<size_t>(y) * m_stride;
+    }
+    uint64_t *row(uint32_t y) noexcept {
+        return m_words.data() + static_cast<size_t>(y) * m_stride;
+    }
+
+    // bits of the padding at the end of the last word of every row are 0
+    uint64_t valid(uint32_t word) const noexcept {
+        const uint32_t tail = m_width % 64;
+        return word + 1 < m_stride || tail == 0 ? ~uint64_t(0)
+                                                : (uint64_t(1) << tail) - 1;
+    }
+
+    bool test(uint32_t x, uint32_t y) const noexcept {
+        return row(y)[x / 64] >> x % 64 & 1;
+    }
+
+    // Bits of the columns x to x + 63 of row y, column x being bit 0. Columns
+    // past the end of the row read as zero.
+    uint64_t window(uint32_t x, uint32_t y) const noexcept {
+        const uint32_t k = x / 64;
+        const uint32_t shift = x % 64;
+        if (k >= m_stride) {
+            return 0;
+        }
+
+        const uint64_t low = row(y)[k] >> shift;
+        if (shift == 0 || k + 1 == m_stride) {
+            return low;
+        }
+        return low | row(y)[k + 1] << (64 - shift);
+    }
+
+    void assign(uint32_t x, uint32_t y, bool value) noexcept {
+        const uint64_t bit = uint64_t(1) << x % 64;
+        auto& word = row(y)[x / 64];
+        word = value ? word | bit : word & ~bit;
+    }
+};
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef CHUNKEDGRIDHPP
+#define CHUNKEDGRIDHPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+// A grid which only stores the Side x Side chunks holding a cell other than
+// T(). A chunk is taken from a pool on its first such write and goes back to
+// it on the next release_empty after all of its cells are T() again, so
+// memory follows what is on the grid instead of its area. The pool grows in
+// blocks and never shrinks.
+//
+// Writes to different chunks may happen on different threads at once. Only
+// taking a chunk from the pool locks it, so a grain falling through empty
+// space doesn't make the threads wait for each other on every chunk it
+// leaves behind.
+template <typename T, uint32_t Side = 16>
+class ChunkedGrid final {
+    static_assert((Side & (Side - 1)) == 0);
+    static constexpr uint32_t chunkCells = Side * Side;
+
+    struct Pool {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<T[]>> blocks;
+        std::vector<T *> free;
+        size_t capacity = 0;
+        // heap allocations made for growing the pool
+        uint64_t allocations = 0;
+    };
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_chunks_x;
+    // nullptr for chunks that are all T(), apart from ones which became
+    // empty since the last release_empty
+    std::vector<T *> m_chunks;
+    // cells other than T() of every chunk
+    std::vector<uint32_t> m_used;
+    std::unique_ptr<Pool> m_pool = std::make_unique<Pool>();
+
+    size_t chunk_of(uint32_t x, uint32_t y) const noexcept {
+        return x / Side + static_cast<size_t>(y / Side) * m_chunks_x;
+    }
+    static uint32_t cell_of(uint32_t x, uint32_t y) noexcept {
+        return x % Side + y % Side * Side;
+    }
+
+    T *take() {
+        std::lock_guard lock(m_pool->mutex);
+        if (m_pool->free.empty()) {
+            // Doubles the pool, but doesn't start too small. It never needs
+            // more chunks than the grid has.
+            const size_t count =
+                std::min(std::max<size_t>(m_pool->capacity, 16),
+                         m_chunks.size() - m_pool->capacity);
+            m_pool->allocations +=
+                1 + (m_pool->blocks.size() == m_pool->blocks.capacity());
+            m_pool->blocks.push_back(
+                std::make_unique<T[]>(count * chunkCells));
+            for (size_t i = count; i-- > 0;) {
+                m_pool->free.push_back(m_pool->blocks.back().get() +
+                                       i * chunkCells);
+            }
+            m_pool->capacity += count;
+        }
+
+        T *const chunk = m_pool->free.back();
+        m_pool->free.pop_back();
+        std::fill(chunk, chunk + chunkCells, T());
+        return chunk;
+    }
+
+
+public:
+    ChunkedGrid(uint32_t width, uint32_t height)
+        : m_width(width),
+          m_height(height),
+          m_chunks_x((width + Side - 1) / Side),
+          m_chunks(static_cast<size_t>(m_chunks_x) *
+                       ((height + Side - 1) / Side),
+                   nullptr),
+          m_used(m_chunks.size(), 0) {
+        m_pool->free.reserve(m_chunks.size());
+    }
+
+    ChunkedGrid(const ChunkedGrid& other)
+        : ChunkedGrid(other.m_width, other.m_height) {
+        for (size_t i = 0; i < m_chunks.size(); i++) {
+            if (other.m_used[i] != 0) {
+                m_chunks[i] = take();
+                std::copy(other.m_chunks[i], other.m_chunks[i] + chunkCells,
+                          m_chunks[i]);
+                m_used[i] = other.m_used[i];
+            }
+        }
+    }
+    ChunkedGrid& operator=(const ChunkedGrid& other) {
+        ChunkedGrid copy(other);
+        return *this = std::move(copy);
+    }
+    // the chunks stay where they are, only the pool changes hands
+    ChunkedGrid(ChunkedGrid&&) noexcept = default;
+    ChunkedGrid& operator=(ChunkedGrid&&) noexcept = default;
+
+    uint32_t width() const noexcept { return m_width; }
+    uint32_t height() const noexcept { return m_height; }
+
+    T at(uint32_t x, uint32_t y) const {
+        if (x >= m_width || y >= m_height) {
+            throw std::runtime_error("Cell position out of bounds");
+        }
+        return get(x, y);
+    }
+
+    // unchecked
+    T get(uint32_t x, uint32_t y) const noexcept {
+        const T *const chunk = m_chunks[chunk_of(x, y)];
+        return chunk == nullptr ? T() : chunk[cell_of(x, y)];
+    }
+
+    // unchecked
+    void set(uint32_t x, uint32_t y, const T& value) {
+        const size_t c = chunk_of(x, y);
+        const bool used = !(value == T());
+        if (m_chunks[c] == nullptr) {
+            if (!used) {
+                return;
+            }
+            m_chunks[c] = take();
+        }
+
+        T& cell = m_chunks[c][cell_of(x, y)];
+        m_used[c] += used;
+        m_used[c] -= !(cell == T());
+        cell = value;
+    }
+
+    // Moves the cell at (x, y) to (toX, toY) and leaves T() behind, unchecked
+    void move(uint32_t x, uint32_t y, uint32_t toX, uint32_t toY) {
+        const size_t c = chunk_of(x, y);
+        if (c != chunk_of(toX, toY) || m_chunks[c] == nullptr) {
+            set(toX, toY, get(x, y));
+            set(x, y, T());
+            return;
+        }
+
+        T& from = m_chunks[c][cell_of(x, y)];
+        T& to = m_chunks[c][cell_of(toX, toY)];
+        m_used[c] -= !(to == T());
+        to = from;
+        from = T();
+    }
+
+    // Gives the chunks which became empty back to the pool, not while other
+    // threads write to the grid
+    void release_empty() noexcept {
+        std::lock_guard lock(m_pool->mutex);
+        for (size_t c = 0; c < m_chunks.size(); c++) {
+            if (m_chunks[c] != nullptr && m_used[c] == 0) {
+                // never grows, it has room for every chunk of the grid
+                m_pool->free.push_back(m_chunks[c]);
+                m_chunks[c] = nullptr;
+            }
+        }
+    }
+
+    // Copies row y into out, which has room for width() cells
+    void copy_row(uint32_t y, T *out) const noexcept {
+        for (uint32_t x = 0; x < m_width; x += Side) {
+            const uint32_t count = std::min(Side, m_width - x);
+            const T *const chunk = m_chunks[chunk_of(x, y)];
+            if (chunk == nullptr) {
+                std::fill(out + x, out + x + count, T());
+            } else {
+                const T *const row = chunk + y % Side * Side;
+                std::copy(row, row + count, out + x);
+            }
+        }
+    }
+
+    size_t chunks_in_use() const noexcept {
+        return m_chunks.size() -
+               std::count(m_used.begin(), m_used.end(), uint32_t(0));
+    }
+
+    // How often the pool went to the heap for more chunks so far
+    uint64_t allocations() const noexcept { return m_pool->allocations; }
+
+    // Heap memory held by the grid, including chunks waiting in the pool
+    size_t capacity_bytes() const noexcept {
+        return m_pool->capacity * chunkCells * sizeof(T) +
+               m_chunks.capacity() * sizeof(T *) +
+               m_used.capacity() * sizeof(uint32_t) +
+               m_pool->free.capacity() * sizeof(T *);
+    }
+};
+
+}  // namespace utils
+
+#endif
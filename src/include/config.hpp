@@ -2,44 +2,63 @@
 #define CONFIGHPP
 
 #include <cstdint>
-#include <tuple>
+#include <string>
 #include <vector>
 
+#include "assets.hpp"
+#include "game.hpp"
+#include "pnm.hpp"
 #include "texture.hpp"
 
 namespace cfg {
 
-static const std::vector<uint32_t> maskColors({0x89FC00, 0xF5B700, 0xDC0073,
+inline const std::vector<uint32_t> maskColors({0x89FC00, 0xF5B700, 0xDC0073,
                                                0x008BF8});
 
-static utils::Color shader(int32_t x, int32_t y,
+// Darkens the pixels on the bottom right edge of the mask
+inline utils::Color shader(int32_t x, int32_t y,
                            const utils::PostProcessedTexture& texture) {
-    utils::Color c(texture.utils::Texture::at(x, y));
-    const auto [r, g, b] = c.asDouble();
-    static const double brightnessDark = 0.6;
-
-    try {
-        if (texture.utils::Texture::at(x + 1, y) == 0 ||
-            texture.utils::Texture::at(x, y + 1) == 0 ||
-            texture.utils::Texture::at(x + 1, y + 1) == 0) {
-            c = std::make_tuple(r * brightnessDark, g * brightnessDark,
-                                b * brightnessDark);
-        }
-    } catch (...) {
-        c = std::make_tuple(r * brightnessDark, g * brightnessDark,
-                            b * brightnessDark);
+    const uint32_t color = texture.utils::Texture::at(x, y);
+    const auto empty = [&texture](uint32_t px, uint32_t py) {
+        return px >= texture.width() || py >= texture.height() ||
+               texture.utils::Texture::at(px, py) == 0;
+    };
+
+    if (!empty(x + 1, y) && !empty(x, y + 1) && !empty(x + 1, y + 1)) {
+        return color;
+    }
+
+    // 0.6 of every channel
+    uint32_t dark = 0;
+    for (uint32_t shift = 0; shift < 24; shift += 8) {
+        dark |= (color >> shift & 0xFF) * 3 / 5 << shift;
     }
+    return dark;
+}
 
-    return c;
+// in the order of assets::masks
+inline const std::vector<std::string> maskFiles({"mask1.ppm", "mask2.ppm",
+                                                 "mask3.ppm", "mask4.ppm",
+                                                 "mask5.ppm"});
+
+// Reads maskFiles from dir
+inline std::vector<utils::PostProcessedTexture> load_masks(
+    const std::string& dir) {
+    std::vector<utils::PostProcessedTexture> masks;
+    for (const auto& file : maskFiles) {
+        masks.emplace_back(utils::PnmParser::parse(dir + "/" + file), shader);
+    }
+    return masks;
 }
 
-static const std::vector<utils::PostProcessedTexture> masks({
-    {utils::P3Parser::parse("assets/mask1.ppm"), shader},
-    {utils::P3Parser::parse("assets/mask2.ppm"), shader},
-    {utils::P3Parser::parse("assets/mask3.ppm"), shader},
-    {utils::P3Parser::parse("assets/mask4.ppm"), shader},
-    {utils::P3Parser::parse("assets/mask5.ppm"), shader},
-});
+// The masks baked into the executable, or the ones in dir when it isn't
+// null. Only the latter reads any files.
+inline game::ShapeRegistry load_shapes(const char *dir) {
+    if (dir != nullptr) {
+        return game::ShapeRegistry(load_masks(dir));
+    }
+    return game::ShapeRegistry(assets::masks, assets::maskCount);
+}
 
 }  // namespace cfg
 
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstdint>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 namespace utils {
@@ -25,6 +26,11 @@ public:
         assert(data.size() == width * height);
     }
 
+    Grid(std::vector<T>&& data, uint32_t width, uint32_t height) noexcept
+        : m_cells(std::move(data)), m_width(width), m_height(height) {
+        assert(m_cells.size() == width * height);
+    }
+
     uint32_t width() const noexcept { return m_width; }
     uint32_t height() const noexcept { return m_height; }
 
@@ -38,35 +44,14 @@ public:
     T& at(uint32_t x, uint32_t y) {
         return const_cast<T&>(static_cast<const Grid<T> *>(this)->at(x, y));
     }
-};
 
-// TODO remove this as it sucks
-template <typename T>
-struct CellNeighbours {
-    T *const top;
-    T *const bottom;
-    T *const left;
-    T *const right;
-    T *const topLeft;
-    T *const topRight;
-    T *const bottomLeft;
-    T *const bottomRight;
-
-    CellNeighbours(Grid<T>& grid, uint32_t x, uint32_t y)
-        : top(y > 0 ? &grid.at(x, y - 1) : nullptr),
-          bottom(y < grid.height() - 1 ? &grid.at(x, y + 1) : nullptr),
-          left(x > 0 ? &grid.at(x - 1, y) : nullptr),
-          right(x < grid.width() - 1 ? &grid.at(x + 1, y) : nullptr),
-          topLeft(top != nullptr && left != nullptr ? &grid.at(x - 1, y - 1)
-                                                    : nullptr),
-          topRight(top != nullptr && right != nullptr ? &grid.at(x + 1, y - 1)
-                                                      : nullptr),
-          bottomLeft(bottom != nullptr && left != nullptr
-                         ? &grid.at(x - 1, y + 1)
-                         : nullptr),
-          bottomRight(bottom != nullptr && right != nullptr
-                          ? &grid.at(x + 1, y + 1)
-                          : nullptr) {}
+    // unchecked access to a whole row
+    const T *row(uint32_t y) const noexcept {
+        return m_cells.data() + static_cast<size_t>(y) * m_width;
+    }
+    T *row(uint32_t y) noexcept {
+        return m_cells.data() + static_cast<size_t>(y) * m_width;
+    }
 };
 
 }  // namespace utils
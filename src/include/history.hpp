@@ -0,0 +1,94 @@
+#ifndef HISTORYHPP
+#define HISTORYHPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "game.hpp"
+
+namespace game {
+
+// Everything of a session tick which isn't a cell of the grid
+struct TickState {
+    uint64_t ticks = 0;
+    double score = 0.0;
+    bool over = false;
+    Solid nextSolid{};
+    std::optional<Solid> currentSolid;
+    uint64_t random = 0;
+};
+
+// The last ticks of a grid, kept for rewinding. Every entry holds the rows
+// which changed since the entry before as the XOR of their old and new cells,
+// run length encoded, so a tick costs about as many bytes as grains moved.
+// Every keyframeInterval entries the whole grid is stored as well. Once the
+// entries take more than maxBytes the oldest ones are dropped, a keyframe
+// and the entries up to the next one at a time.
+//
+// The awake chunks are kept along with the cells, sand only moves the same
+// way after a rewind when the same chunks are asleep.
+class History {
+    struct Entry {
+        TickState state;
+        // changes since the entry before
+        std::string delta;
+        // the rows against an empty grid, only set on keyframes
+        bool keyframe;
+        std::string cells;
+    };
+
+    uint32_t width;
+    uint32_t height;
+    size_t maxBytes;
+    uint32_t keyframeInterval;
+    std::deque<Entry> entries;
+    size_t bytes = 0;
+    uint32_t sinceKeyframe = 0;
+    // cells and awake chunks of the newest entry, the cells packed like
+    // SandGrid::packed_row
+    std::vector<uint32_t> shadow;
+    std::vector<uint8_t> awake;
+    // grid revision of the newest entry, rows above it changed since
+    uint64_t revision;
+    std::vector<uint32_t> row;
+    std::vector<uint8_t> touched;
+    std::string buffer;
+
+    void add(const SandGrid& grid, const TickState& state, bool keyframe);
+    void apply(const std::string& rows) noexcept;
+    bool drop_oldest() noexcept;
+
+public:
+    static constexpr uint32_t defaultInterval = 64;
+
+    // The first entry is the grid as it is now. Keyframes are interval
+    // entries apart and the entries take about budget bytes.
+    History(const SandGrid& grid, const TickState& state, size_t budget,
+            uint32_t interval = defaultInterval);
+
+    // Adds the grid after a tick, only rows with a higher revision than the
+    // last time are looked at
+    void push(const SandGrid& grid, const TickState& state);
+
+    // how many ticks back rewind can go
+    uint64_t depth() const noexcept { return entries.size() - 1; }
+    // memory held by the entries, the shadow grid not included
+    size_t size_bytes() const noexcept { return bytes; }
+
+    // Puts the grid back by ticks entries, or as far as it goes, and drops
+    // the entries after it. Short steps undo the newest deltas, longer ones
+    // start at the keyframe before and go forward, so neither takes more
+    // than keyframeInterval deltas. Only changed rows are written to the
+    // grid. Returns how many entries it went back.
+    uint64_t rewind(SandGrid& grid, uint64_t ticks);
+    // state of the newest entry
+    const TickState& state() const noexcept { return entries.back().state; }
+};
+
+}  // namespace game
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef LOCKFREEHPP
+#define LOCKFREEHPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+
+// Hands the newest value from one writer thread to one reader thread. The
+// writer fills back() and publishes it, the reader swaps in whatever was
+// published last and keeps reading front() until it swaps again. Neither
+// side ever waits for the other.
+template <typename T>
+class TripleBuffer final {
+    static constexpr uint8_t fresh = 4;
+
+    std::array<T, 3> m_slots;
+    // slot between the two sides, or'ed with fresh when the writer put a
+    // value there which the reader hasn't taken yet
+    std::atomic<uint8_t> m_middle = 1;
+    uint8_t m_back = 0;
+    uint8_t m_front = 2;
+
+public:
+    // writer thread only
+    T& back() noexcept { return m_slots[m_back]; }
+    void publish() noexcept {
+        m_back = m_middle.exchange(m_back | fresh, std::memory_order_acq_rel) &
+                 ~fresh;
+    }
+
+    // Reader thread only. Returns false when nothing was published since the
+    // last call.
+    bool update() noexcept {
+        if ((m_middle.load(std::memory_order_relaxed) & fresh) == 0) {
+            return false;
+        }
+        m_front =
+            m_middle.exchange(m_front, std::memory_order_acq_rel) & ~fresh;
+        return true;
+    }
+    const T& front() const noexcept { return m_slots[m_front]; }
+};
+
+// Fixed size queue from one producer thread to one consumer thread, both
+// sides finish in a bounded number of steps.
+template <typename T, size_t Capacity>
+class SpscQueue final {
+    static_assert((Capacity & (Capacity - 1)) == 0);
+
+    std::array<T, Capacity> m_items;
+    // next item to pop, only written by the consumer
+    alignas(64) std::atomic<size_t> m_head = 0;
+    // next item to push, only written by the producer
+    alignas(64) std::atomic<size_t> m_tail = 0;
+
+public:
+    // producer thread only, returns false when the queue is full
+    bool push(const T& item) noexcept {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        m_items[tail % Capacity] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer thread only, returns false when the queue is empty
+    bool pop(T& item) noexcept {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = m_items[head % Capacity];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef MAPPEDFILEHPP
+#define MAPPEDFILEHPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#include <vector>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace utils {
+
+// A whole file mapped read only into memory. Where mmap doesn't exist the
+// file is read into a buffer instead.
+class MappedFile final {
+#ifdef _WIN32
+    std::vector<uint8_t> m_buffer;
+#else
+    void *m_data = nullptr;
+#endif
+    size_t m_size = 0;
+
+public:
+    // Throws std::runtime_error when the file can't be read
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("can't open " + path);
+        }
+        m_buffer.assign(std::istreambuf_iterator<char>(file),
+                        std::istreambuf_iterator<char>());
+        m_size = m_buffer.size();
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can't open " + path);
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("can't read " + path);
+        }
+        m_size = static_cast<size_t>(info.st_size);
+
+        // an empty file can't be mapped, it has nothing to read anyway
+        if (m_size != 0) {
+            m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (m_data == MAP_FAILED) {
+            m_data = nullptr;
+            throw std::runtime_error("can't map " + path);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (m_data != nullptr) {
+            munmap(m_data, m_size);
+        }
+#endif
+    }
+
+    const uint8_t *data() const noexcept {
+#ifdef _WIN32
+        return m_buffer.data();
+#else
+        return static_cast<const uint8_t *>(m_data);
+#endif
+    }
+    size_t size() const noexcept { return m_size; }
+};
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef PNMHPP
+#define PNMHPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mappedfile.hpp"
+#include "texture.hpp"
+
+namespace utils {
+
+// Reads P3 (ASCII color), P5 (binary grey) and P6 (binary color) netpbm
+// images with 8 or 16 bit samples into 0xRRGGBB textures. Samples are
+// scaled from the file's maxval to 0 to 255, grey is copied into every
+// channel. The file is memory mapped and converted straight into the
+// texture's buffer.
+class PnmParser final {
+    const uint8_t *m_it;
+    const uint8_t *m_end;
+    const std::string& m_path;
+
+    PnmParser(const MappedFile& file, const std::string& path) noexcept
+        : m_it(file.data()),
+          m_end(file.data() + file.size()),
+          m_path(path) {}
+
+    [[noreturn]] void fail(const char *reason) const {
+        throw std::runtime_error(std::string(reason) + ": " + m_path);
+    }
+
+    static bool is_space(uint8_t c) noexcept {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+               c == '\f';
+    }
+
+    // skips whitespace and comments running to the end of their line
+    void skip_space() noexcept {
+        while (m_it != m_end && (is_space(*m_it) || *m_it == '#')) {
+            if (*m_it == '#') {
+                while (m_it != m_end && *m_it != '\n') {
+                    m_it++;
+                }
+            } else {
+                m_it++;
+            }
+        }
+    }
+
+    uint32_t read_number(uint32_t max) {
+        skip_space();
+        if (m_it == m_end || *m_it < '0' || *m_it > '9') {
+            fail(m_it == m_end ? "truncated image file"
+                               : "bad image file format");
+        }
+
+        uint64_t value = 0;
+        while (m_it != m_end && *m_it >= '0' && *m_it <= '9') {
+            value = value * 10 + (*m_it++ - '0');
+            if (value > max) {
+                fail("image value out of range");
+            }
+        }
+        return static_cast<uint32_t>(value);
+    }
+
+    // table of the 8 bit value of every sample up to maxval
+    static std::vector<uint8_t> scale_table(uint32_t maxval) {
+        std::vector<uint8_t> table(maxval + 1);
+        for (uint32_t v = 0; v <= maxval; v++) {
+            table[v] = static_cast<uint8_t>((v * 255 + maxval / 2) / maxval);
+        }
+        return table;
+    }
+
+    Texture parse() {
+        if (m_end - m_it < 2 || m_it[0] != 'P') {
+            fail("bad image file format");
+        }
+        const uint8_t kind = m_it[1];
+        if (kind != '3' && kind != '5' && kind != '6') {
+            fail("unsupported image file format");
+        }
+        m_it += 2;
+
+        // keeps width * height * 6 bytes well inside of size_t
+        const uint32_t maxSide = 1 << 16;
+        const uint32_t width = read_number(maxSide);
+        const uint32_t height = read_number(maxSide);
+        const uint32_t maxval = read_number(65535);
+        if (width == 0 || height == 0 || maxval == 0) {
+            fail("bad image file format");
+        }
+
+        // The size is checked against the file before the texture is made,
+        // so a few bytes of header can't ask for gigabytes.
+        const size_t pixels = static_cast<size_t>(width) * height;
+        const uint32_t channels = kind == '5' ? 1 : 3;
+
+        if (kind == '3') {
+            // every sample is at least a space and a digit
+            if (static_cast<size_t>(m_end - m_it) < pixels * 6) {
+                fail("truncated image file");
+            }
+            std::vector<uint32_t> texture(pixels);
+            const auto table = scale_table(maxval);
+            for (size_t i = 0; i < pixels; i++) {
+                const uint32_t r = table[read_number(maxval)];
+                const uint32_t g = table[read_number(maxval)];
+                const uint32_t b = table[read_number(maxval)];
+                texture[i] = r << 16 | g << 8 | b;
+            }
+            return Texture(std::move(texture), width, height);
+        }
+
+        // exactly one whitespace byte separates the header from the samples
+        if (m_it == m_end || !is_space(*m_it)) {
+            fail(m_it == m_end ? "truncated image file"
+                               : "bad image file format");
+        }
+        m_it++;
+
+        const size_t bytes = maxval > 255 ? 2 : 1;
+        if (static_cast<size_t>(m_end - m_it) < pixels * channels * bytes) {
+            fail("truncated image file");
+        }
+        std::vector<uint32_t> texture(pixels);
+
+        const uint8_t *const samples = m_it;
+        if (maxval == 255) {
+            // the common case, a plain repack the compiler can vectorize
+            for (size_t i = 0; i < pixels; i++) {
+                const uint8_t *const s = samples + i * channels;
+                const uint32_t r = s[0];
+                const uint32_t g = s[channels / 3];
+                const uint32_t b = s[channels / 3 * 2];
+                texture[i] = r << 16 | g << 8 | b;
+            }
+        } else {
+            const auto table = scale_table(maxval);
+            const auto sample = [&](size_t i) -> uint32_t {
+                const uint32_t value =
+                    bytes == 1 ? samples[i]
+                               : samples[i * 2] << 8 | samples[i * 2 + 1];
+                if (value > maxval) {
+                    fail("image value out of range");
+                }
+                return table[value];
+            };
+            for (size_t i = 0; i < pixels; i++) {
+                const size_t s = i * channels;
+                texture[i] = sample(s) << 16 |
+                             sample(s + channels / 3) << 8 |
+                             sample(s + channels / 3 * 2);
+            }
+        }
+        return Texture(std::move(texture), width, height);
+    }
+
+public:
+    // Throws std::runtime_error for files that can't be read, are cut short
+    // or aren't one of the supported formats
+    static Texture parse(const std::string& path) {
+        const MappedFile file(path);
+        return PnmParser(file, path).parse();
+    }
+};
+
+}  // namespace utils
+
+#endif
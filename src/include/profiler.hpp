@@ -0,0 +1,246 @@
+#ifndef PROFILERHPP
+#define PROFILERHPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// The PROFILE_ macros only do something when PROFILE is defined, otherwise
+// they compile to nothing and the game carries no timers at all.
+#ifdef PROFILE
+#define PROFILE_SCOPE(phase) \
+    const utils::ScopedTimer profileTimer(utils::Phase::phase)
+#define PROFILE_COUNT(counter, n) \
+    utils::profiler().count(utils::Counter::counter, n)
+#define PROFILE_END_TICK() utils::profiler().end_tick()
+#else
+#define PROFILE_SCOPE(phase) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_END_TICK() ((void)0)
+#endif
+
+namespace utils {
+
+enum class Phase : uint8_t {
+    input,
+    tick,
+    moveSolid,
+    updateSand,
+    findAreas,
+    removeAreas,
+    render,
+    draw,
+    present,
+};
+inline constexpr size_t phaseCount = 9;
+inline constexpr std::array<const char *, phaseCount> phaseNames{
+    "input",        "tick",   "move_solid", "update_sand", "find_areas",
+    "remove_areas", "render", "draw",       "present"};
+
+// Summed up over a tick and kept per tick
+enum class Counter : uint8_t { grainsMoved, cellsScanned, areasCleared };
+inline constexpr size_t counterCount = 3;
+inline constexpr std::array<const char *, counterCount> counterNames{
+    "grains_moved", "cells_scanned", "areas_cleared"};
+
+// Keeps the last historySize durations of every phase and counters of every
+// tick for percentiles, and the last traceSize timings for exporting. All
+// buffers are made up front, so recording never allocates.
+class Profiler final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t historySize = 1024;
+    static constexpr size_t traceSize = 1 << 16;
+
+private:
+    struct Event {
+        Phase phase;
+        uint32_t thread;
+        // nanoseconds since the profiler was made
+        uint64_t start;
+        uint64_t duration;
+    };
+
+    struct Tick {
+        uint32_t thread;
+        uint64_t end;
+        std::array<uint64_t, counterCount> counters;
+    };
+
+    template <typename T, size_t Size>
+    struct Ring {
+        std::vector<T> items = std::vector<T>(Size);
+        // every item ever pushed, the last Size of them are kept
+        uint64_t pushed = 0;
+
+        void push(const T& item) noexcept { items[pushed++ % Size] = item; }
+        size_t size() const noexcept {
+            return static_cast<size_t>(std::min<uint64_t>(pushed, Size));
+        }
+        // from the oldest kept item to the newest one
+        template <typename F>
+        void for_each(F&& f) const {
+            for (uint64_t i = pushed - size(); i < pushed; i++) {
+                f(items[i % Size]);
+            }
+        }
+    };
+
+    mutable std::mutex m_mutex;
+    const Clock::time_point m_epoch = Clock::now();
+    std::array<Ring<uint64_t, historySize>, phaseCount> m_durations;
+    Ring<Event, traceSize> m_events;
+    Ring<Tick, historySize> m_ticks;
+    // counters of the running tick
+    std::array<std::atomic<uint64_t>, counterCount> m_counters{};
+    std::atomic<uint32_t> m_threads = 0;
+
+    uint64_t since_epoch(Clock::time_point time) const noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time -
+                                                                    m_epoch)
+            .count();
+    }
+
+    // small number of the calling thread for the trace
+    uint32_t thread_id() noexcept {
+        thread_local const uint32_t id = m_threads++;
+        return id;
+    }
+
+    template <typename T, size_t Size, typename F>
+    static uint64_t percentile_of(const Ring<T, Size>& ring, double p,
+                                  F&& value) {
+        if (ring.size() == 0) {
+            return 0;
+        }
+        std::array<uint64_t, Size> values;
+        size_t count = 0;
+        ring.for_each([&](const T& item) { values[count++] = value(item); });
+
+        const auto nth = values.begin() + static_cast<size_t>(p * (count - 1));
+        std::nth_element(values.begin(), nth, values.begin() + count);
+        return *nth;
+    }
+
+public:
+    void record(Phase phase, Clock::time_point start,
+                Clock::time_point end) noexcept {
+        const uint64_t begin = since_epoch(start);
+        const uint64_t duration = since_epoch(end) - begin;
+        const uint32_t thread = thread_id();
+
+        std::lock_guard lock(m_mutex);
+        m_durations[static_cast<size_t>(phase)].push(duration);
+        m_events.push({phase, thread, begin, duration});
+    }
+
+    void count(Counter counter, uint64_t n) noexcept {
+        m_counters[static_cast<size_t>(counter)].fetch_add(
+            n, std::memory_order_relaxed);
+    }
+
+    // Keeps the counters of the tick which just ended and starts over
+    void end_tick() noexcept {
+        Tick tick{thread_id(), since_epoch(Clock::now()), {}};
+        for (size_t i = 0; i < counterCount; i++) {
+            tick.counters[i] =
+                m_counters[i].exchange(0, std::memory_order_relaxed);
+        }
+
+        std::lock_guard lock(m_mutex);
+        m_ticks.push(tick);
+    }
+
+    // p is in [0, 1], the result is in nanoseconds
+    uint64_t percentile(Phase phase, double p) const {
+        std::lock_guard lock(m_mutex);
+        return percentile_of(m_durations[static_cast<size_t>(phase)], p,
+                             [](uint64_t duration) { return duration; });
+    }
+
+    // p is in [0, 1], over the counts of the last ticks
+    uint64_t percentile(Counter counter, double p) const {
+        std::lock_guard lock(m_mutex);
+        const auto i = static_cast<size_t>(counter);
+        return percentile_of(m_ticks, p, [i](const Tick& tick) {
+            return tick.counters[i];
+        });
+    }
+
+    // Chrome trace event format, opens in chrome://tracing and Perfetto
+    void write_chrome_trace(std::ostream& out) const {
+        std::lock_guard lock(m_mutex);
+        out << "{\"traceEvents\":[";
+        const char *separator = "\n";
+        m_events.for_each([&](const Event& event) {
+            out << separator << "{\"name\":\""
+                << phaseNames[static_cast<size_t>(event.phase)]
+                << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+                << ",\"ts\":" << event.start / 1000.0
+                << ",\"dur\":" << event.duration / 1000.0 << '}';
+            separator = ",\n";
+        });
+        m_ticks.for_each([&](const Tick& tick) {
+            out << separator << "{\"name\":\"tick\",\"ph\":\"C\",\"pid\":0,"
+                << "\"tid\":" << tick.thread << ",\"ts\":" << tick.end / 1000.0
+                << ",\"args\":{";
+            for (size_t i = 0; i < counterCount; i++) {
+                out << (i == 0 ? "" : ",") << '"' << counterNames[i]
+                    << "\":" << tick.counters[i];
+            }
+            out << "}}";
+        });
+        out << "\n]}\n";
+    }
+
+    // One row per timing and one per counter of every tick, all times in
+    // nanoseconds
+    void write_csv(std::ostream& out) const {
+        std::lock_guard lock(m_mutex);
+        out << "name,thread,start_ns,duration_ns,value\n";
+        m_events.for_each([&](const Event& event) {
+            out << phaseNames[static_cast<size_t>(event.phase)] << ','
+                << event.thread << ',' << event.start << ','
+                << event.duration << ",\n";
+        });
+        m_ticks.for_each([&](const Tick& tick) {
+            for (size_t i = 0; i < counterCount; i++) {
+                out << counterNames[i] << ',' << tick.thread << ','
+                    << tick.end << ",0," << tick.counters[i] << '\n';
+            }
+        });
+    }
+};
+
+inline Profiler& profiler() {
+    static Profiler instance;
+    return instance;
+}
+
+// Records the time from its construction to its destruction
+class ScopedTimer final {
+    Phase m_phase;
+    // made before the clock is read, so the first timing starts after the
+    // profiler's epoch
+    Profiler& m_profiler = profiler();
+    Profiler::Clock::time_point m_start = Profiler::Clock::now();
+
+public:
+    explicit ScopedTimer(Phase phase) noexcept : m_phase(phase) {}
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    ~ScopedTimer() {
+        m_profiler.record(m_phase, m_start, Profiler::Clock::now());
+    }
+};
+
+}  // namespace utils
+
+#endif
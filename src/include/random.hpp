@@ -0,0 +1,61 @@
+#ifndef RANDOMHPP
+#define RANDOMHPP
+
+#include <cstdint>
+
+namespace utils {
+
+// splitmix64: a single word of state, 64 random bits per call and any number
+// of independent streams can be derived from one seed, which keeps parallel
+// code deterministic no matter which thread runs what.
+class Random final {
+    uint64_t m_state;
+
+public:
+    static constexpr uint64_t mix(uint64_t z) noexcept {
+        z = (z ^ z >> 30) * 0xBF58476D1CE4E5B9;
+        z = (z ^ z >> 27) * 0x94D049BB133111EB;
+        return z ^ z >> 31;
+    }
+
+    explicit Random(uint64_t seed) noexcept : m_state(seed) {}
+    // stream number `stream` of the given seed
+    Random(uint64_t seed, uint64_t stream) noexcept
+        : m_state(mix(seed ^ mix(stream + 1))) {}
+
+    uint64_t state() const noexcept { return m_state; }
+
+    uint64_t next() noexcept { return mix(m_state += 0x9E3779B97F4A7C15); }
+
+    // uniform in [0, bound)
+    uint32_t below(uint32_t bound) noexcept {
+        return static_cast<uint32_t>((next() >> 32) * bound >> 32);
+    }
+};
+
+// Hands out the bits of a Random one by one, or 64 of them at once
+class CoinFlips final {
+    Random m_random;
+    uint64_t m_bits = 0;
+    uint32_t m_left = 0;
+
+public:
+    explicit CoinFlips(Random random) noexcept : m_random(random) {}
+
+    uint64_t word() noexcept { return m_random.next(); }
+
+    bool operator()() noexcept {
+        if (m_left == 0) {
+            m_bits = m_random.next();
+            m_left = 64;
+        }
+        m_left--;
+        const bool bit = m_bits & 1;
+        m_bits >>= 1;
+        return bit;
+    }
+};
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef REPLAYHPP
+#define REPLAYHPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "session.hpp"
+
+namespace game {
+
+// The seed and the keys of every tick of one session. Sessions only depend
+// on those, so playing them back gives the same game on any machine, as
+// fast as it can tick.
+class Recording {
+    // ticks in a row with the same keys
+    struct Run {
+        uint8_t keys;
+        uint64_t ticks;
+    };
+
+    std::vector<Run> runs;
+    uint64_t ticks_ = 0;
+
+public:
+    uint32_t width;
+    uint32_t height;
+    uint32_t palette;
+    uint64_t seed;
+    // SandGrid::hash after the last tick, if it was known when saving
+    std::optional<uint64_t> hash;
+
+    // a recording of Session(width, height, shapes, palette, seed)
+    Recording(uint32_t w, uint32_t h, uint32_t colors,
+              uint64_t sessionSeed) noexcept
+        : width(w), height(h), palette(colors), seed(sessionSeed) {}
+
+    // Throws std::runtime_error when the file can't be read or isn't a
+    // recording
+    static Recording load(const std::string& path);
+    // Throws std::runtime_error when the file can't be written
+    void save(const std::string& path) const;
+
+    // Appends the keys of the next tick
+    void push(const Input& input);
+
+    uint64_t ticks() const noexcept { return ticks_; }
+
+    // Calls f with the input of every tick, from the first to the last
+    template <typename F>
+    void for_each_input(F&& f) const {
+        for (const auto& run : runs) {
+            const Input input{(run.keys & 1) != 0, (run.keys & 2) != 0,
+                              (run.keys & 4) != 0, (run.keys & 8) != 0};
+            for (uint64_t i = 0; i < run.ticks; i++) {
+                f(input);
+            }
+        }
+    }
+};
+
+}  // namespace game
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SCHEDULERHPP
+#define SCHEDULERHPP
+
+#include <chrono>
+#include <cstdint>
+
+namespace utils {
+
+// Hands out fixed size time steps as the clock passes them. After a stall
+// at most maxCatchUp steps are due at once, the rest are dropped instead of
+// running back to back.
+class FixedStep final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    Clock::duration m_step;
+    uint32_t m_max_catch_up;
+    Clock::time_point m_next;
+
+public:
+    FixedStep(Clock::duration step, uint32_t maxCatchUp,
+              Clock::time_point now = Clock::now()) noexcept
+        : m_step(step), m_max_catch_up(maxCatchUp), m_next(now + step) {}
+
+    // The next step is due one step after now
+    void reset(Clock::time_point now = Clock::now()) noexcept {
+        m_next = now + m_step;
+    }
+
+    // Number of steps which became due since the last call
+    uint32_t due(Clock::time_point now = Clock::now()) noexcept {
+        if (now < m_next) {
+            return 0;
+        }
+
+        const auto steps = (now - m_next) / m_step + 1;
+        if (steps > m_max_catch_up) {
+            m_next = now + m_step;
+            return m_max_catch_up;
+        }
+        m_next += steps * m_step;
+        return static_cast<uint32_t>(steps);
+    }
+
+    // Whole milliseconds until the next step is due, rounded up
+    uint32_t wait_ms(Clock::time_point now = Clock::now()) const noexcept {
+        if (now >= m_next) {
+            return 0;
+        }
+        const auto wait = m_next - now;
+        return static_cast<uint32_t>(
+            std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+    }
+};
+
+}  // namespace utils
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef SESSIONHPP
+#define SESSIONHPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "game.hpp"
+#include "history.hpp"
+
+namespace game {
+
+// Keys held down during a tick
+struct Input {
+    bool left = false;
+    bool right = false;
+    bool down = false;
+    // only set on the tick the key got pressed
+    bool rotate = false;
+};
+
+// Everything the window needs to draw a session, copied out of it after a
+// tick
+struct Frame {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // color << 8 | shade of every cell, row after row
+    std::vector<uint16_t> cells;
+    // see SandGrid::revision
+    uint64_t revision = 0;
+    std::vector<uint64_t> rowRevisions;
+    Solid nextSolid{};
+    double score = 0.0;
+    bool over = false;
+    // Set by whoever captures the frame, tells games apart. Revisions of a
+    // new game start over.
+    uint64_t game = 0;
+};
+
+// One game from the first solid to game over, without any window around it
+class Session {
+    uint32_t colors;
+    SandGrid grid_;
+    Solid nextSolid{};
+    uint64_t ticks = 0;
+    double score_ = 0.0;
+    bool over = false;
+    std::optional<History> history_;
+
+    Solid random_solid() noexcept;
+    TickState tick_state() noexcept;
+    void resolve_collision();
+    void advance(const Input& input);
+
+    Session(uint32_t palette, SandGrid&& grid) noexcept
+        : colors(palette), grid_(std::move(grid)) {}
+
+public:
+    // The solid falls a cell every tick, sand moves every sandTicks ticks
+    static constexpr uint32_t tickMs = 10;
+    static constexpr uint32_t sandTicks = 2;
+
+    // solids get a random color below palette
+    Session(uint32_t width, uint32_t height, const ShapeRegistry& shapes,
+            uint32_t palette, uint64_t seed);
+
+    // Advances the game by one tick. Returns false when the game was already
+    // over and nothing changed.
+    bool tick(const Input& input);
+
+    // Keeps the ticks from now on for rewind, in about maxBytes. Ticks
+    // don't allocate without it.
+    void keep_history(size_t maxBytes,
+                      uint32_t keyframeInterval = History::defaultInterval);
+    // Goes back by count ticks, or as far as the history reaches, and returns
+    // how many it went back. The game plays on from there like it did the
+    // first time.
+    uint64_t rewind(uint64_t count);
+    const std::optional<History>& history() const noexcept { return history_; }
+
+    const SandGrid& grid() const noexcept { return grid_; }
+    const Solid& next_solid() const noexcept { return nextSolid; }
+    double score() const noexcept { return score_; }
+    bool is_over() const noexcept { return over; }
+
+    // Copies the session into frame, which only allocates the first time
+    void capture(Frame& frame) const;
+
+    // A snapshot of the whole session. Loading it goes on with the same
+    // game, ticks included. Throws std::runtime_error when the file can't be
+    // written.
+    void save(const std::string& path) const;
+    // Throws std::runtime_error when the file can't be read, isn't a
+    // snapshot or was saved with another palette size
+    static Session load(const std::string& path, const ShapeRegistry& shapes,
+                        uint32_t palette);
+};
+
+}  // namespace game
+
+#endif
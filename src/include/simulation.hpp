@@ -0,0 +1,70 @@
+#ifndef SIMULATIONTHREADHPP
+#define SIMULATIONTHREADHPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <thread>
+
+#include "game.hpp"
+#include "lockfree.hpp"
+#include "session.hpp"
+
+namespace game {
+
+// Sent from the window to the simulation thread
+struct Command {
+    // replaces the keys held so far, a rotation waits for the next tick
+    Input input;
+    // starts a new game with this seed
+    std::optional<uint64_t> restart;
+};
+
+// Runs a Session on its own thread at Session::tickMs. The window sends
+// commands through a wait free queue and reads the newest frame from a
+// triple buffer, so neither side ever waits for the other.
+class SimulationThread {
+    const ShapeRegistry& registry;
+    uint32_t columns;
+    uint32_t rows;
+    uint32_t colors;
+    // only touched by the simulation thread once it runs
+    Session session;
+    uint64_t game = 0;
+
+    utils::SpscQueue<Command, 64> commands;
+    utils::TripleBuffer<Frame> frames;
+    std::function<void()> onPublish;
+    std::atomic<bool> stop = false;
+    std::thread thread;
+
+    void publish();
+    void run();
+
+public:
+    // published is called on the simulation thread after every new frame
+    SimulationThread(uint32_t width, uint32_t height,
+                     const ShapeRegistry& shapes, uint32_t palette,
+                     uint64_t seed, std::function<void()> published = {});
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    ~SimulationThread();
+
+    // Window thread only. Returns false when the queue is full and the
+    // command was dropped.
+    bool send(const Command& command) noexcept {
+        return commands.push(command);
+    }
+
+    // Window thread only. Takes the newest frame, returns false when there
+    // was none since the last call.
+    bool update() noexcept { return frames.update(); }
+    const Frame& frame() const noexcept { return frames.front(); }
+};
+
+}  // namespace game
+
+#endif
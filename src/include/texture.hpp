@@ -1,12 +1,11 @@
 #ifndef TEXTUREHPP
 #define TEXTUREHPP
 
+#include <algorithm>
 #include <cstdint>
-#include <fstream>
 #include <functional>
-#include <iostream>
-#include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include "grid.hpp"
@@ -18,6 +17,9 @@ public:
     Texture(const std::vector<uint32_t>& texture, uint32_t width,
             uint32_t height) noexcept
         : Grid(texture, width, height) {}
+    Texture(std::vector<uint32_t>&& texture, uint32_t width,
+            uint32_t height) noexcept
+        : Grid(std::move(texture), width, height) {}
 
     Texture ror() noexcept {
         std::vector<uint32_t> textureRot(width() * height());
@@ -30,38 +32,6 @@ public:
     }
 };
 
-struct P3Parser final {
-    static Texture parse(const std::string& pgmFilePath) {
-        std::ifstream file(pgmFilePath);
-
-        std::string buf;
-        file >> buf;
-        if (buf != "P6") {
-            throw std::runtime_error("bad image file format");
-        }
-
-        uint32_t width, height, max;
-        file >> width >> height >> max;
-
-        auto it = std::istreambuf_iterator<char>(file >> std::ws);
-        std::vector<uint32_t> pixels;
-
-        for (size_t y = 0; y < height; y++) {
-            for (size_t x = 0; x < width; x++) {
-                uint32_t r = *it++;
-                uint32_t g = *it++;
-                uint32_t b = *it++;
-                pixels.push_back(
-                    (static_cast<double>(r << 16 | g << 8 | b) / max) * 255.0);
-            }
-        }
-
-        return Texture(pixels, width, height);
-    }
-
-    P3Parser() = delete;
-};
-
 class Color final {
     uint32_t m_color;
 
@@ -86,24 +56,33 @@ public:
     }
 };
 
+// The shader runs once per pixel when the texture is made, at() only reads
+// the stored result. Texture::at still gives the unshaded pixels.
 class PostProcessedTexture : public Texture {
     typedef std::function<Color(int32_t, int32_t, const PostProcessedTexture&)>
         shader;
 
     shader processor_;
+    Grid<uint32_t> baked_;
 
 public:
-    uint32_t at(uint32_t x, uint32_t y) const {
-        if (x >= width() || y >= height()) {
-            throw std::runtime_error("Texture position out of bounds");
-        }
-        return processor_(x, y, *this).asInt();
-    }
+    uint32_t at(uint32_t x, uint32_t y) const { return baked_.at(x, y); }
+    // unchecked access to a whole row of shaded pixels
+    const uint32_t *row(uint32_t y) const noexcept { return baked_.row(y); }
 
-    PostProcessedTexture ror() noexcept { return {Texture::ror(), processor_}; }
+    PostProcessedTexture ror() { return {Texture::ror(), processor_}; }
 
-    PostProcessedTexture(const Texture& texture, shader processor) noexcept
-        : Texture(texture), processor_(processor) {}
+    PostProcessedTexture(const Texture& texture, shader processor)
+        : Texture(texture),
+          processor_(processor),
+          baked_(texture.width(), texture.height()) {
+        for (uint32_t y = 0; y < height(); y++) {
+            uint32_t *const pixels = baked_.row(y);
+            for (uint32_t x = 0; x < width(); x++) {
+                pixels[x] = processor_(x, y, *this).asInt();
+            }
+        }
+    }
 };
 
 }  // namespace utils
@@ -0,0 +1,112 @@
+#ifndef WORKERSHPP
+#define WORKERSHPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils {
+
+// A fixed set of threads for running parallel for loops. The calling thread
+// works on the loop too, so a pool of size 1 has no extra threads at all.
+class WorkerPool final {
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+
+    void (*m_invoke)(void *, size_t) = nullptr;
+    void *m_job = nullptr;
+    size_t m_count = 0;
+    std::atomic<size_t> m_next = 0;
+    size_t m_busy = 0;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+
+    void work() noexcept {
+        for (size_t i = m_next++; i < m_count; i = m_next++) {
+            m_invoke(m_job, i);
+        }
+    }
+
+    void loop() noexcept {
+        uint64_t generation = 0;
+        while (true) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_start.wait(lock, [&] {
+                    return m_stop || m_generation != generation;
+                });
+                if (m_stop) {
+                    return;
+                }
+                generation = m_generation;
+            }
+
+            work();
+
+            std::lock_guard lock(m_mutex);
+            if (--m_busy == 0) {
+                m_done.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit WorkerPool(
+        unsigned size = std::max(1u, std::thread::hardware_concurrency())) {
+        for (unsigned i = 1; i < size; i++) {
+            m_threads.emplace_back([this] { loop(); });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_start.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    size_t size() const noexcept { return m_threads.size() + 1; }
+
+    // Calls job(i) for every i below count and returns once all are done.
+    // The job must not throw.
+    template <typename F>
+    void run(size_t count, F& job) noexcept {
+        if (count == 0) {
+            return;
+        }
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_invoke = [](void *f, size_t i) { (*static_cast<F *>(f))(i); };
+            m_job = &job;
+            m_count = count;
+            m_next = 0;
+            m_busy = m_threads.size();
+            m_generation++;
+        }
+        m_start.notify_all();
+
+        work();
+
+        std::unique_lock lock(m_mutex);
+        m_done.wait(lock, [this] { return m_busy == 0; });
+    }
+};
+
+}  // namespace utils
+
+#endif
@@ -1,9 +1,12 @@
 #include <SDL_error.h>
 #include <SDL_events.h>
 #include <SDL_render.h>
+#include <SDL_ttf.h>
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <stdexcept>
@@ -14,36 +17,256 @@
 
 namespace kiss {
 
+// A component is drawn again only while it is dirty. Setting is_ready in
+// process_event makes it dirty, so do the functions which change how it
+// looks.
 struct Component {
     unsigned x, y;
     virtual void init(kiss_window *window, SDL_Renderer *renderer) = 0;
     virtual void process_event(SDL_Event *event, int *is_ready) = 0;
+    // Only copies to the current render target, which may be clipped. It
+    // can be called more than once per frame.
     virtual void draw(SDL_Renderer *renderer) = 0;
+    // Where draw paints, in window coordinates
+    virtual SDL_Rect bounds() const noexcept = 0;
+    // Makes what draw copies, once per frame and only while dirty. The render
+    // target is the screen.
+    virtual void prepare(SDL_Renderer *) {}
+
+    virtual bool is_dirty() const noexcept { return m_dirty; }
+    virtual void mark_clean() noexcept { m_dirty = false; }
+    void mark_dirty() noexcept { m_dirty = true; }
 
     Component(unsigned x_pos, unsigned y_pos) noexcept : x(x_pos), y(y_pos) {}
     Component(const Component&) = default;
     Component& operator=(const Component&) = default;
     virtual ~Component() {}
+
+protected:
+    bool m_dirty = true;
+};
+
+// Every printable ASCII glyph of a font rasterized once, and sprites, packed
+// into one texture. Both are white with the coverage in alpha, so drawing
+// tints them with the texture's color mod. Text costs one copy per glyph,
+// which the renderer batches, and nothing is rasterized after construction.
+class GlyphAtlas final {
+public:
+    // 0xRRGGBB, row after row. The brightest channel is the coverage.
+    struct Sprite {
+        unsigned width;
+        unsigned height;
+        const uint32_t *pixels;
+    };
+
+    // dst is relative to where the quads are drawn
+    struct Quad {
+        SDL_Rect src;
+        SDL_Rect dst;
+    };
+
+private:
+    static constexpr char firstGlyph = ' ';
+    static constexpr char lastGlyph = '~';
+    static constexpr int width = 512;
+
+    struct Glyph {
+        SDL_Rect src;
+        int advance;
+    };
+
+    SDL_Texture *m_texture = nullptr;
+    Glyph m_glyphs[lastGlyph - firstGlyph + 1];
+    std::vector<SDL_Rect> m_sprites;
+    int m_spacing;
+    int m_lineheight;
+    int m_advance;
+
+public:
+    GlyphAtlas(SDL_Renderer *renderer, const kiss_font& font,
+               const std::vector<Sprite>& sprites)
+        : m_spacing(font.spacing),
+          m_lineheight(font.lineheight),
+          m_advance(font.advance) {
+        using Surface = std::unique_ptr<SDL_Surface, void (*)(SDL_Surface *)>;
+        const SDL_Color white{255, 255, 255, 255};
+
+        // shelves as wide as the atlas, filled from left to right
+        int shelf_x = 0;
+        int shelf_y = 0;
+        int shelf_h = 0;
+        const auto place = [&](int w, int h) {
+            if (shelf_x + w > width) {
+                shelf_x = 0;
+                shelf_y += shelf_h;
+                shelf_h = 0;
+            }
+            const SDL_Rect rect{shelf_x, shelf_y, w, h};
+            shelf_x += w;
+            shelf_h = std::max(shelf_h, h);
+            return rect;
+        };
+
+        std::vector<Surface> glyphs;
+        for (char c = firstGlyph; c <= lastGlyph; c++) {
+            glyphs.emplace_back(TTF_RenderGlyph_Blended(font.font, c, white),
+                                SDL_FreeSurface);
+            Glyph& glyph = m_glyphs[c - firstGlyph];
+            if (glyphs.back() == nullptr) {
+                glyph = {{0, 0, 0, 0}, font.advance};
+            } else {
+                glyph = {place(glyphs.back()->w, glyphs.back()->h),
+                         glyphs.back()->w};
+            }
+        }
+        for (const auto& sprite : sprites) {
+            m_sprites.push_back(place(sprite.width, sprite.height));
+        }
+
+        const Surface atlas(
+            SDL_CreateRGBSurfaceWithFormat(0, width, shelf_y + shelf_h, 32,
+                                           SDL_PIXELFORMAT_RGBA32),
+            SDL_FreeSurface);
+        if (atlas == nullptr) {
+            throw std::runtime_error(SDL_GetError());
+        }
+
+        for (size_t i = 0; i < glyphs.size(); i++) {
+            if (glyphs[i] != nullptr) {
+                SDL_SetSurfaceBlendMode(glyphs[i].get(), SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(glyphs[i].get(), nullptr, atlas.get(),
+                                &m_glyphs[i].src);
+            }
+        }
+        for (size_t i = 0; i < sprites.size(); i++) {
+            const Sprite& sprite = sprites[i];
+            const SDL_Rect& rect = m_sprites[i];
+            for (unsigned y = 0; y < sprite.height; y++) {
+                uint32_t *const row = reinterpret_cast<uint32_t *>(
+                    static_cast<uint8_t *>(atlas->pixels) +
+                    (rect.y + y) * atlas->pitch);
+                for (unsigned x = 0; x < sprite.width; x++) {
+                    const uint32_t pixel = sprite.pixels[x + y * sprite.width];
+                    const uint8_t alpha = std::max(
+                        {pixel >> 16 & 0xFF, pixel >> 8 & 0xFF, pixel & 0xFF});
+                    row[rect.x + x] =
+                        SDL_MapRGBA(atlas->format, 255, 255, 255, alpha);
+                }
+            }
+        }
+
+        m_texture = SDL_CreateTextureFromSurface(renderer, atlas.get());
+        if (m_texture == nullptr) {
+            throw std::runtime_error(SDL_GetError());
+        }
+        SDL_SetTextureBlendMode(m_texture, SDL_BLENDMODE_BLEND);
+    }
+
+    GlyphAtlas(const GlyphAtlas&) = delete;
+    GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+    ~GlyphAtlas() { SDL_DestroyTexture(m_texture); }
+
+    const SDL_Rect& sprite(size_t i) const noexcept { return m_sprites[i]; }
+
+    // Appends the quads of text, lines are laid out like kiss_label_draw does
+    // it. Characters without a glyph are left blank. Returns the size of the
+    // text.
+    SDL_Rect layout_text(const char *text, std::vector<Quad>& quads) const {
+        SDL_Rect size{0, 0, 0, m_spacing / 2 + m_lineheight};
+        int pen = 0;
+        for (const char *c = text; *c != 0; c++) {
+            if (*c == '\n') {
+                pen = 0;
+                size.h += m_lineheight;
+                continue;
+            }
+
+            if (*c < firstGlyph || *c > lastGlyph) {
+                pen += m_advance;
+            } else {
+                const Glyph& glyph = m_glyphs[*c - firstGlyph];
+                if (glyph.src.w != 0) {
+                    quads.push_back({glyph.src,
+                                     {pen, size.h - m_lineheight, glyph.src.w,
+                                      glyph.src.h}});
+                }
+                pen += glyph.advance;
+            }
+            size.w = std::max(size.w, pen);
+        }
+        if (size.w == 0) {
+            size.h = 0;
+        }
+        return size;
+    }
+
+    void draw(SDL_Renderer *renderer, const std::vector<Quad>& quads, int x,
+              int y, SDL_Color color) const noexcept {
+        SDL_SetTextureColorMod(m_texture, color.r, color.g, color.b);
+        for (const auto& quad : quads) {
+            const SDL_Rect dst{x + quad.dst.x, y + quad.dst.y, quad.dst.w,
+                               quad.dst.h};
+            SDL_RenderCopy(renderer, m_texture, &quad.src, &dst);
+        }
+    }
 };
 
+// The window is composed in a texture which keeps what was drawn, so a frame
+// only draws the dirty components again. The background and every component
+// overlapping one of them are drawn too, clipped to where the dirty one was
+// and is now. Labels draw their text from the window's atlas of
+// kiss_textfont and the sprites it was made with.
 class Window final {
     kiss_array m_objects;
     SDL_Renderer *m_renderer = nullptr;
     kiss_window m_window;
+    SDL_Texture *m_frame = nullptr;
+    std::unique_ptr<GlyphAtlas> m_atlas;
     bool m_is_open = true;
-    // TODO rename every is_ready to should_redraw
-    int m_is_ready = 0;
+    // the whole window is drawn again, like on the first frame
+    bool m_redraw_all = true;
 
     std::vector<std::unique_ptr<Component>> m_components;
+    // bounds of every component when it was last drawn
+    std::vector<SDL_Rect> m_drawn;
+
+    // clip is nullptr for the whole window
+    void paint(const SDL_Rect *clip) {
+        SDL_RenderSetClipRect(m_renderer, clip);
+        kiss_window_draw(&m_window, m_renderer);
+
+        for (auto& e : m_components) {
+            const SDL_Rect bounds = e->bounds();
+            if (clip == nullptr || SDL_HasIntersection(clip, &bounds)) {
+                e->draw(m_renderer);
+            }
+        }
+    }
 
 public:
-    Window(const std::string& title, unsigned w, unsigned h)
+    Window(const std::string& title, unsigned w, unsigned h,
+           const std::vector<GlyphAtlas::Sprite>& sprites = {})
         : m_renderer(
               kiss_init(const_cast<char *>(title.data()), &m_objects, w, h)) {
         if (m_renderer == nullptr) {
             throw std::runtime_error(SDL_GetError());
         }
 
+        try {
+            m_frame = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_RGBA32,
+                                        SDL_TEXTUREACCESS_TARGET,
+                                        kiss_screen_width, kiss_screen_height);
+            if (m_frame == nullptr) {
+                throw std::runtime_error(SDL_GetError());
+            }
+            m_atlas = std::make_unique<GlyphAtlas>(m_renderer, kiss_textfont,
+                                                   sprites);
+        } catch (...) {
+            SDL_DestroyTexture(m_frame);
+            kiss_clean(&m_objects);
+            throw;
+        }
+
         kiss_window_new(&m_window, nullptr, 1, 0, 0, kiss_screen_width,
                         kiss_screen_height);
         m_window.visible = 1;
@@ -51,12 +274,17 @@ public:
 
     Window(const Window&) = delete;
     Window& operator=(const Window&) = delete;
-    ~Window() { kiss_clean(&m_objects); }
+    ~Window() {
+        m_atlas.reset();
+        SDL_DestroyTexture(m_frame);
+        kiss_clean(&m_objects);
+    }
 
     template <typename T>
     T& register_component(std::unique_ptr<T>&& component) {
         component->init(&m_window, m_renderer);
         m_components.push_back(std::move(component));
+        m_drawn.push_back({0, 0, 0, 0});
         return static_cast<T&>(*m_components.back());
     }
 
@@ -65,42 +293,98 @@ public:
             m_is_open = false;
         }
 
+        int redraw = 0;
         kiss_window_event(&m_window, const_cast<SDL_Event *>(&event),
-                          &m_is_ready);
+                          &redraw);
+        if (redraw) {
+            m_redraw_all = true;
+        }
 
         for (auto& e : m_components) {
-            e->process_event(const_cast<SDL_Event *>(&event), &m_is_ready);
+            redraw = 0;
+            e->process_event(const_cast<SDL_Event *>(&event), &redraw);
+            if (redraw) {
+                e->mark_dirty();
+            }
         }
     }
 
-    void draw() noexcept {
-        kiss_window_draw(&m_window, m_renderer);
-
+    void draw() {
         for (auto& e : m_components) {
-            e->draw(m_renderer);
+            if (e->is_dirty()) {
+                e->prepare(m_renderer);
+            }
         }
-    }
 
-    void flush() noexcept {
-        SDL_RenderPresent(m_renderer);
-        m_is_ready = 0;
+        SDL_SetRenderTarget(m_renderer, m_frame);
+        if (m_redraw_all) {
+            paint(nullptr);
+        } else {
+            for (size_t i = 0; i < m_components.size(); i++) {
+                if (!m_components[i]->is_dirty()) {
+                    continue;
+                }
+
+                const SDL_Rect bounds = m_components[i]->bounds();
+                SDL_Rect damage;
+                SDL_UnionRect(&m_drawn[i], &bounds, &damage);
+                if (!SDL_RectEmpty(&damage)) {
+                    paint(&damage);
+                }
+            }
+        }
+        SDL_RenderSetClipRect(m_renderer, nullptr);
+        SDL_SetRenderTarget(m_renderer, nullptr);
+
+        for (size_t i = 0; i < m_components.size(); i++) {
+            m_components[i]->mark_clean();
+            m_drawn[i] = m_components[i]->bounds();
+        }
+        m_redraw_all = false;
+
+        SDL_RenderCopy(m_renderer, m_frame, nullptr, nullptr);
     }
 
-    void force_redraw() noexcept { m_is_ready = 1; }
+    void flush() noexcept { SDL_RenderPresent(m_renderer); }
+
+    void force_redraw() noexcept { m_redraw_all = true; }
 
     bool is_open() const noexcept { return m_is_open; }
-    bool is_ready() const noexcept { return m_is_ready; }
+    const GlyphAtlas& atlas() const noexcept { return *m_atlas; }
+    // whether draw has anything to do
+    bool is_ready() const noexcept {
+        return m_redraw_all ||
+               std::any_of(m_components.begin(), m_components.end(),
+                           [](const auto& e) { return e->is_dirty(); });
+    }
 };
 
+// The text is laid out into glyph quads when it changes, drawing only copies
+// them out of the window's atlas
 class Label final : public Component {
-    kiss_label m_label;
+    const GlyphAtlas& m_atlas;
+    kiss_label m_label{};
+    std::vector<GlyphAtlas::Quad> m_quads;
+    SDL_Rect m_size{0, 0, 0, 0};
+    // m_quads don't hold the text yet
+    bool m_stale = true;
 
 public:
-    Label(unsigned x, unsigned y) noexcept : Component(x, y) {}
+    Label(const GlyphAtlas& atlas, unsigned x, unsigned y) noexcept
+        : Component(x, y), m_atlas(atlas) {}
+
+    // Only a different text makes the label dirty
+    void update_text(const char *text) noexcept {
+        char copy[KISS_MAX_LABEL];
+        kiss_string_copy(copy, KISS_MAX_LABEL, nullptr,
+                         const_cast<char *>(text));
+        if (std::strcmp(copy, m_label.text) == 0) {
+            return;
+        }
 
-    void update_text(const std::string& text) noexcept {
-        kiss_string_copy(m_label.text, KISS_MAX_LABEL, nullptr,
-                         const_cast<char *>(text.data()));
+        std::memcpy(m_label.text, copy, KISS_MAX_LABEL);
+        m_stale = true;
+        mark_dirty();
     }
 
     void init(kiss_window *window, SDL_Renderer *renderer) noexcept override {
@@ -110,8 +394,95 @@ public:
 
     void process_event(SDL_Event *event, int *is_ready) noexcept override {}
 
+    void prepare(SDL_Renderer *) override {
+        if (m_stale) {
+            m_stale = false;
+            m_quads.clear();
+            m_size = m_atlas.layout_text(m_label.text, m_quads);
+        }
+    }
+
+    void draw(SDL_Renderer *renderer) noexcept override {
+        if (m_label.wdw != nullptr) {
+            m_label.visible = m_label.wdw->visible;
+        }
+        if (m_label.visible) {
+            m_atlas.draw(renderer, m_quads, x, y, m_label.textcolor);
+        }
+    }
+
+    SDL_Rect bounds() const noexcept override {
+        return {static_cast<int>(x), static_cast<int>(y), m_size.w, m_size.h};
+    }
+};
+
+// A number drawn with the digit sprites of the window's atlas, first is the
+// sprite of 0. The sprites are scaled up by scale.
+class SpriteNumber final : public Component {
+    const GlyphAtlas& m_atlas;
+    size_t m_first;
+    int m_scale;
+    SDL_Color m_color;
+    kiss_window *m_window = nullptr;
+    uint64_t m_value = 0;
+    std::vector<GlyphAtlas::Quad> m_quads;
+    SDL_Rect m_size{0, 0, 0, 0};
+    // m_quads don't hold m_value yet
+    bool m_stale = true;
+
+public:
+    SpriteNumber(const GlyphAtlas& atlas, unsigned x, unsigned y, size_t first,
+                 int scale, SDL_Color color = {0, 0, 0, 255}) noexcept
+        : Component(x, y),
+          m_atlas(atlas),
+          m_first(first),
+          m_scale(scale),
+          m_color(color) {}
+
+    // Only a different value makes the number dirty
+    void update_value(uint64_t value) noexcept {
+        if (value != m_value) {
+            m_value = value;
+            m_stale = true;
+            mark_dirty();
+        }
+    }
+
+    void init(kiss_window *window, SDL_Renderer *) noexcept override {
+        m_window = window;
+    }
+
+    void process_event(SDL_Event *, int *) noexcept override {}
+
+    void prepare(SDL_Renderer *) override {
+        if (!m_stale) {
+            return;
+        }
+        m_stale = false;
+
+        char digits[24];
+        const int count =
+            std::snprintf(digits, sizeof(digits), "%llu",
+                          static_cast<unsigned long long>(m_value));
+        m_quads.clear();
+        m_size = {0, 0, 0, 0};
+        for (int i = 0; i < count; i++) {
+            const SDL_Rect& src = m_atlas.sprite(m_first + (digits[i] - '0'));
+            m_quads.push_back({src, {m_size.w, 0, src.w * m_scale,
+                                     src.h * m_scale}});
+            m_size.w += src.w * m_scale;
+            m_size.h = std::max(m_size.h, src.h * m_scale);
+        }
+    }
+
     void draw(SDL_Renderer *renderer) noexcept override {
-        kiss_label_draw(&m_label, renderer);
+        if (m_window == nullptr || m_window->visible) {
+            m_atlas.draw(renderer, m_quads, x, y, m_color);
+        }
+    }
+
+    SDL_Rect bounds() const noexcept override {
+        return {static_cast<int>(x), static_cast<int>(y), m_size.w, m_size.h};
     }
 };
 
@@ -139,8 +510,12 @@ public:
     void draw(SDL_Renderer *renderer) noexcept override {
         kiss_button_draw(&m_button, renderer);
     }
+
+    SDL_Rect bounds() const noexcept override { return m_button.rect; }
 };
 
+// The components of a container have to stay inside of it. It is dirty while
+// one of them is.
 class Container final : public Component {
     kiss_window m_window;
     SDL_Renderer *m_renderer;
@@ -161,11 +536,23 @@ public:
         kiss_window_event(&m_window, event, is_ready);
 
         for (auto& e : m_components) {
-            e->process_event(event, is_ready);
+            int redraw = 0;
+            e->process_event(event, &redraw);
+            if (redraw) {
+                e->mark_dirty();
+            }
         }
     }
 
-    void draw(SDL_Renderer *renderer) noexcept override {
+    void prepare(SDL_Renderer *renderer) override {
+        for (auto& e : m_components) {
+            if (e->is_dirty()) {
+                e->prepare(renderer);
+            }
+        }
+    }
+
+    void draw(SDL_Renderer *renderer) override {
         kiss_window_draw(&m_window, renderer);
 
         for (auto& e : m_components) {
@@ -173,6 +560,21 @@ public:
         }
     }
 
+    SDL_Rect bounds() const noexcept override { return m_window.rect; }
+
+    bool is_dirty() const noexcept override {
+        return m_dirty ||
+               std::any_of(m_components.begin(), m_components.end(),
+                           [](const auto& e) { return e->is_dirty(); });
+    }
+
+    void mark_clean() noexcept override {
+        m_dirty = false;
+        for (auto& e : m_components) {
+            e->mark_clean();
+        }
+    }
+
     template <typename T>
     T& register_component(std::unique_ptr<T>&& component) {
         component->init(&m_window, m_renderer);
@@ -180,7 +582,12 @@ public:
         return static_cast<T&>(*m_components.back());
     }
 
-    void set_visibility(bool visibile) noexcept { m_window.visible = visibile; }
+    void set_visibility(bool visibile) noexcept {
+        if (m_window.visible != visibile) {
+            m_window.visible = visibile;
+            mark_dirty();
+        }
+    }
 };
 
 class Canvas final : public Component {
@@ -189,6 +596,12 @@ class Canvas final : public Component {
 
     SDL_Texture *m_texture = nullptr;
     SDL_PixelFormat *m_format = nullptr;
+    // rows m_first_row to m_first_row + m_rows - 1 are locked
+    uint32_t *m_pixels = nullptr;
+    // in pixels
+    unsigned m_pitch = 0;
+    unsigned m_first_row = 0;
+    unsigned m_rows = 0;
 
 public:
     Canvas(unsigned x, unsigned y, unsigned tex_w, unsigned tex_h,
@@ -228,39 +641,101 @@ public:
 
     void process_event(SDL_Event *event, int *is_ready) override {}
 
-    // TODO organize
-    uint32_t *pixels = nullptr;
-
-    void fill(uint32_t color) noexcept {
-        std::fill(pixels, pixels + m_tex_w * m_tex_h, color);
+    uint32_t map_rgb(uint8_t r, uint8_t g, uint8_t b) const noexcept {
+        return SDL_MapRGB(m_format, r, g, b);
     }
 
-    void set_pixel(int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b) {
-        if (x < 0 || y < 0 || x >= m_tex_w || y >= m_tex_h) {
-            throw std::runtime_error("canvas coordinate out of bounds");
+    // Pixel of palette color c at shade s (0 to 255) is at index c << 8 | s
+    std::vector<uint32_t> shade_table(
+        const std::vector<uint32_t>& palette) const {
+        std::vector<uint32_t> table(palette.size() << 8);
+        for (size_t c = 0; c < palette.size(); c++) {
+            const uint32_t r = palette[c] >> 16 & 0xFF;
+            const uint32_t g = palette[c] >> 8 & 0xFF;
+            const uint32_t b = palette[c] & 0xFF;
+            for (uint32_t s = 0; s < 256; s++) {
+                table[c << 8 | s] =
+                    map_rgb(r * s / 255, g * s / 255, b * s / 255);
+            }
         }
-        pixels[x + y * m_tex_w] = SDL_MapRGB(m_format, r, g, b);
+        return table;
     }
 
-    void draw(SDL_Renderer *renderer) override {
+    // Locks h rows starting at row y for f, which writes them through the
+    // functions below, and uploads them afterwards. The old content of the
+    // rows is lost, so all of their pixels have to be written. Rows that
+    // aren't painted keep what they had.
+    template <typename F>
+    void paint_rows(unsigned y, unsigned h, F&& f) {
+        const SDL_Rect rect{0, static_cast<int>(y), static_cast<int>(m_tex_w),
+                            static_cast<int>(h)};
         int pitch;
-        if (SDL_LockTexture(m_texture, nullptr,
-                            reinterpret_cast<void **>(&pixels), &pitch) != 0) {
+        if (SDL_LockTexture(m_texture, &rect,
+                            reinterpret_cast<void **>(&m_pixels),
+                            &pitch) != 0) {
             throw std::runtime_error(SDL_GetError());
         }
+        m_pitch = pitch / sizeof(uint32_t);
+        m_first_row = y;
+        m_rows = h;
 
-        m_on_draw(*this);
+        f();
 
         SDL_UnlockTexture(m_texture);
+        m_pixels = nullptr;
+        m_rows = 0;
+    }
+
+    template <typename F>
+    void paint(F&& f) {
+        paint_rows(0, m_tex_h, f);
+    }
 
-        SDL_Rect rect;
-        rect.x = x;
-        rect.y = y;
-        rect.w = m_scr_w;
-        rect.h = m_scr_h;
+    // Only for locked rows. Rows can be further apart than the canvas is
+    // wide.
+    uint32_t *row(unsigned y) noexcept {
+        return m_pixels + (y - m_first_row) * m_pitch;
+    }
+
+    void fill(uint32_t color) noexcept {
+        for (unsigned y = m_first_row; y < m_first_row + m_rows; y++) {
+            std::fill(row(y), row(y) + m_tex_w, color);
+        }
+    }
+
+    void set_pixel(int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b) {
+        if (x < 0 || y < static_cast<int32_t>(m_first_row) ||
+            static_cast<unsigned>(x) >= m_tex_w ||
+            static_cast<unsigned>(y) >= m_first_row + m_rows) {
+            throw std::runtime_error("canvas coordinate out of bounds");
+        }
+        row(y)[x] = map_rgb(r, g, b);
+    }
+
+    // Writes count pixels of row y looked up from a shade_table, cells hold
+    // color << 8 | shade
+    void convert_row(unsigned y, const uint16_t *cells, unsigned count,
+                     const uint32_t *table) noexcept {
+        uint32_t *const pixels = row(y);
+        for (unsigned x = 0; x < count; x++) {
+            pixels[x] = table[cells[x]];
+        }
+    }
+
+    // on_draw paints the rows which changed, the texture keeps the others.
+    // The canvas has to be marked dirty for it to run.
+    void prepare(SDL_Renderer *) override { m_on_draw(*this); }
+
+    void draw(SDL_Renderer *renderer) override {
+        const SDL_Rect rect = bounds();
         // assume no error :)
         SDL_RenderCopy(renderer, m_texture, nullptr, &rect);
     }
+
+    SDL_Rect bounds() const noexcept override {
+        return {static_cast<int>(x), static_cast<int>(y),
+                static_cast<int>(m_scr_w), static_cast<int>(m_scr_h)};
+    }
 };
 
 class KeyboardListener final : public Component {
@@ -293,6 +768,7 @@ public:
 
     void init(kiss_window *, SDL_Renderer *) noexcept override {}
     void draw(SDL_Renderer *) noexcept override {}
+    SDL_Rect bounds() const noexcept override { return {0, 0, 0, 0}; }
 };
 
 }  // namespace kiss
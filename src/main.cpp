@@ -1,184 +1,283 @@
 #include <SDL_events.h>
 #include <SDL_scancode.h>
-#include <SDL_timer.h>
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
-#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <memory>
-#include <ostream>
-#include <string>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <vector>
 
+#include "assets.hpp"
 #include "config.hpp"
 #include "game.hpp"
 #include "kiss.hpp"
 #include "kiss_sdl.h"
+#include "profiler.hpp"
+#include "replay.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
+#include "simulation.hpp"
 #include "texture.hpp"
 
-// TODO remove
-double second = 0.0;
-
-static game::Solid gen_random_solid(uint32_t x) {
-    return {cfg::masks[rand() % cfg::masks.size()],
-            cfg::maskColors[rand() % cfg::maskColors.size()], x, 0};
-}
-
-struct GameState {
-    double sand_tick = 0.0;
-    double solid_tick = 0.0;
-    uint32_t start_time = SDL_GetTicks();
-    double score = 0.0;
-    game::Solid next_solid;
-    bool game_over = false;
-
-    GameState(game::Solid&& initial_next_solid)
-        : next_solid(initial_next_solid) {}
+// The game and revision of the frame on the canvas
+struct Drawn {
+    uint64_t game = 0;
+    uint64_t revision = 0;
 };
 
-static void collision_resolution(game::SandGrid& grid, GameState& state) {
-    if (grid.does_current_solid_collide()) {
-        grid.convert_current_solid_to_sand();
-        grid.place_solid(state.next_solid);
-        state.next_solid = gen_random_solid(grid.width() / 3);
-    }
-}
-
-static auto game_render(game::SandGrid& grid) {
-    return [&grid](kiss::Canvas& canvas) {
-        for (uint32_t y = 0; y < grid.height(); y++) {
-            for (uint32_t x = 0; x < grid.width(); x++) {
-                const auto& cell = grid.at(x, y);
+// shades is a kiss::Canvas::shade_table of cfg::maskColors. Only the rows
+// that changed after the drawn revision are painted again, all of them when
+// the frame is from another game.
+static auto game_render(const game::Frame *const& frame,
+                        const std::vector<uint32_t>& shades, Drawn& drawn) {
+    return [&frame, &shades, &drawn](kiss::Canvas& canvas) {
+        PROFILE_SCOPE(render);
+        if (frame->game != drawn.game) {
+            drawn = {frame->game, 0};
+        }
+        const auto changed = [&](uint32_t y) {
+            return frame->rowRevisions[y] > drawn.revision;
+        };
 
-                const auto col =
-                    cell.state == game::GrainState::empty ? 0 : cell.color;
-                const auto [r, g, b] = utils::Color(col).asDouble();
+        for (uint32_t y = 0; y < frame->height; y++) {
+            if (!changed(y)) {
+                continue;
+            }
 
-                canvas.set_pixel(x, y, r * cell.mask, g * cell.mask,
-                                 b * cell.mask);
+            uint32_t end = y + 1;
+            while (end < frame->height && changed(end)) {
+                end++;
             }
+
+            canvas.paint_rows(y, end - y, [&] {
+                for (uint32_t row = y; row < end; row++) {
+                    canvas.convert_row(
+                        row, frame->cells.data() + row * frame->width,
+                        frame->width, shades.data());
+                }
+            });
+            y = end;
         }
+        drawn.revision = frame->revision;
     };
 }
 
-static void game_logic(kiss::Window& w, kiss::KeyboardListener& k,
-                       game::SandGrid& grid, GameState& state) {
-    const auto now = SDL_GetTicks();
-    const auto dt = (now - state.start_time) / 1000.0;
-    state.start_time = now;
-    second += dt;
-
-    if (k.is_key_down(SDL_SCANCODE_LEFT)) {
-        grid.move_current_solid(game::Direction::left);
-        collision_resolution(grid, state);
-        w.force_redraw();
-    }
-    if (k.is_key_down(SDL_SCANCODE_RIGHT)) {
-        grid.move_current_solid(game::Direction::right);
-        collision_resolution(grid, state);
-        w.force_redraw();
-    }
-    if (k.is_key_down(SDL_SCANCODE_DOWN)) {
-        grid.move_current_solid(game::Direction::down);
-        collision_resolution(grid, state);
-        state.score += dt * 5.0;
-        w.force_redraw();
-    }
-    if (k.is_key_down_once(SDL_SCANCODE_UP)) {
-        grid.rotate_current_solid();
-        collision_resolution(grid, state);
-        w.force_redraw();
-    }
-
-    state.sand_tick += dt;
-    if (state.sand_tick > 0.02) {
-        state.sand_tick -= 0.02;
-        grid.update_sand();
-        collision_resolution(grid, state);
-
-        const auto id = game::get_any_area_id(grid);
-        if (id.has_value()) {
-            state.score += game::remove_area(grid, id.value()) / 4;
-        }
-
-        w.force_redraw();
+#ifdef PROFILE
+// Median and 99th percentile of the last timings of every phase in
+// microseconds and of the counters of the last ticks
+static void profile_text(char *text, size_t size) {
+    const auto& profiler = utils::profiler();
+    size_t written = std::snprintf(text, size, "us      p50    p99\n");
+    for (size_t i = 0; i < utils::phaseCount && written < size; i++) {
+        const auto phase = static_cast<utils::Phase>(i);
+        written += std::snprintf(
+            text + written, size - written, "%-7.7s%6.0f %6.0f\n",
+            utils::phaseNames[i], profiler.percentile(phase, 0.5) / 1000.0,
+            profiler.percentile(phase, 0.99) / 1000.0);
     }
-
-    state.solid_tick += dt;
-    if (state.solid_tick > 0.01) {
-        state.solid_tick -= 0.01;
-        grid.move_current_solid(game::Direction::down);
-        collision_resolution(grid, state);
-        w.force_redraw();
+    for (size_t i = 0; i < utils::counterCount && written < size; i++) {
+        const auto counter = static_cast<utils::Counter>(i);
+        written += std::snprintf(
+            text + written, size - written, "%-7.7s%6llu %6llu\n",
+            utils::counterNames[i],
+            static_cast<unsigned long long>(profiler.percentile(counter, 0.5)),
+            static_cast<unsigned long long>(
+                profiler.percentile(counter, 0.99)));
     }
 }
+#endif
 
 // w.register_component(std::make_unique<kiss::Button>(
 //     "Click me", 50, 90, [&c] { c.set_visibility(true); }));
 
-int main() {
+// Runs the game on this thread between events, or on its own thread with
+// --sim-thread. --record FILE saves the keys of the last game to FILE on
+// exit, tetrisand_bench --replay FILE plays them back. --save FILE saves a
+// snapshot of the last game on exit, --load FILE goes on with one instead of
+// starting a new game. --assets DIR loads the masks from DIR instead of the
+// ones baked into the executable. --rewind keeps the last few minutes of the
+// game, every press of backspace goes back a second.
+int main(int argc, char *argv[]) {
     using std::make_unique;
 
-    kiss::Window w("Tetrisand", 535, 710);
+    bool threaded = false;
+    const char *record_path = nullptr;
+    const char *save_path = nullptr;
+    const char *load_path = nullptr;
+    const char *assets_dir = nullptr;
+    bool rewind = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--sim-thread") == 0) {
+            threaded = true;
+        } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            load_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--assets") == 0 && i + 1 < argc) {
+            assets_dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--rewind") == 0) {
+            rewind = true;
+        }
+    }
+    if (threaded && (record_path != nullptr || save_path != nullptr ||
+                     load_path != nullptr || rewind)) {
+        std::fprintf(stderr,
+                     "--record, --save, --load and --rewind run the game on "
+                     "the main thread\n");
+        threaded = false;
+    }
+    // A recording starts with a new game and only goes forward. It doesn't
+    // know the masks either, replays always use the baked ones.
+    if (record_path != nullptr &&
+        (load_path != nullptr || rewind || assets_dir != nullptr)) {
+        std::fprintf(stderr,
+                     "--record doesn't work with --load, --rewind or "
+                     "--assets\n");
+        record_path = nullptr;
+    }
+
+    // the digits are the first sprites of the window's atlas
+    std::vector<kiss::GlyphAtlas::Sprite> sprites;
+    for (const auto& digit : assets::digits) {
+        sprites.push_back({digit.width, digit.height, digit.pixels});
+    }
+    kiss::Window w("Tetrisand", 535, 710, sprites);
     auto& k = w.register_component(make_unique<kiss::KeyboardListener>());
 
     // TITLE
-    w.register_component(make_unique<kiss::Label>(16, kiss_textfont.lineheight))
+    w.register_component(
+          make_unique<kiss::Label>(w.atlas(), 16, kiss_textfont.lineheight))
         .update_text("Tetrisand");
 
     // CANVAS
-    game::SandGrid grid(80, 160);
-    grid.place_solid(gen_random_solid(grid.width() / 3));
-    GameState state(gen_random_solid(grid.width() / 3));
+    const game::ShapeRegistry shapes = cfg::load_shapes(assets_dir);
+    const uint32_t width = 80;
+    const uint32_t height = 160;
+    const uint32_t palette = cfg::maskColors.size();
+
+    // Only one of them runs the game. The simulation thread wakes this one
+    // up with frameEvent whenever it publishes a frame.
+    std::optional<game::Session> session;
+    std::unique_ptr<game::SimulationThread> simulation;
+    game::Frame captured;
+    const game::Frame *frame = &captured;
+    std::optional<game::Recording> recording;
+    // the games are told apart by the frames, their revisions start over
+    uint64_t games = 0;
+    // about a thousand bytes per tick, so a few minutes
+    const size_t historyBytes = 64 << 20;
+    const uint64_t rewindTicks = 1000 / game::Session::tickMs;
+
+    const auto start_session = [&](uint64_t seed) {
+        session.emplace(width, height, shapes, palette, seed);
+        if (rewind) {
+            session->keep_history(historyBytes);
+        }
+        session->capture(captured);
+        captured.game = games;
+        if (record_path != nullptr) {
+            recording.emplace(width, height, palette, seed);
+        }
+    };
 
-    w.register_component(make_unique<kiss::Canvas>(
-        16, kiss_textfont.lineheight * 3, grid.width(), grid.height(),
-        grid.width() * 4, grid.height() * 4, game_render(grid)));
+    if (threaded) {
+        const uint32_t frameEvent = SDL_RegisterEvents(1);
+        simulation = make_unique<game::SimulationThread>(
+            width, height, shapes, palette, std::random_device()(),
+            [frameEvent] {
+                SDL_Event event{};
+                event.type = frameEvent;
+                SDL_PushEvent(&event);
+            });
+        frame = &simulation->frame();
+    } else if (load_path != nullptr) {
+        try {
+            session.emplace(game::Session::load(load_path, shapes, palette));
+        } catch (const std::runtime_error& error) {
+            std::fprintf(stderr, "%s\n", error.what());
+            return 1;
+        }
+        if (session->grid().width() != width ||
+            session->grid().height() != height) {
+            std::fprintf(stderr, "%s isn't a game on a %ux%u grid\n",
+                         load_path, width, height);
+            return 1;
+        }
+        if (rewind) {
+            session->keep_history(historyBytes);
+        }
+        session->capture(captured);
+    } else {
+        start_session(std::random_device()());
+    }
+
+    std::vector<uint32_t> shades;
+    Drawn drawn;
+    auto& canvas = w.register_component(make_unique<kiss::Canvas>(
+        16, kiss_textfont.lineheight * 3, width, height, width * 4,
+        height * 4, game_render(frame, shades, drawn)));
+    shades = canvas.shade_table(cfg::maskColors);
 
-    const int canvas_end_x = 16 + grid.width() * 4;
+    const int canvas_end_x = 16 + width * 4;
 
     // INFO WINDOW
     auto& info = w.register_component(make_unique<kiss::Container>(
-        canvas_end_x + 16, kiss_textfont.lineheight * 3, grid.width() * 2,
+        canvas_end_x + 16, kiss_textfont.lineheight * 3, width * 2,
         16 + kiss_textfont.lineheight * 2 + 64));
     info.set_visibility(true);
 
     const int info_end_y = info.y + info.h;
 
     // INFO WINDOW -> SCORE
-    auto& score = info.register_component(
-        make_unique<kiss::Label>(info.x + 8, info.y + 8));
+    info.register_component(
+            make_unique<kiss::Label>(w.atlas(), info.x + 8, info.y + 8))
+        .update_text("Score:");
+    auto& score = info.register_component(make_unique<kiss::SpriteNumber>(
+        w.atlas(), info.x + 8 + kiss_textfont.advance * 7, info.y + 8, 0, 2));
 
     // INFO WINDOW -> NEXT SHAPE
     info
         .register_component(make_unique<kiss::Label>(
-            info.x + 8, info.y + 8 + kiss_textfont.lineheight * 2))
+            w.atlas(), info.x + 8, info.y + 8 + kiss_textfont.lineheight * 2))
         .update_text("Next:");
 
-    w.register_component(make_unique<kiss::Canvas>(
+    auto& next_shape = w.register_component(make_unique<kiss::Canvas>(
         info.x + 8 + kiss_textfont.advance * 6,
         info.y + 8 + kiss_textfont.lineheight * 2, 24, 32, 48, 64,
-        [&state](auto& canvas) {
-            canvas.fill(0xFFFFFF);
-            auto& tex = state.next_solid.texture;
-            const auto [rc, gc, bc] =
-                utils::Color(state.next_solid.color).asDouble();
-            for (uint32_t y = 0; y < tex.height(); ++y) {
-                for (uint32_t x = 0; x < tex.width(); ++x) {
-                    if (tex.at(x, y) == 0) {
-                        canvas.set_pixel(x, y, 255, 255, 255);
-                        continue;
+        [&frame, &shapes, &shades](auto& preview) {
+            preview.paint([&] {
+                const uint32_t white = preview.map_rgb(255, 255, 255);
+                preview.fill(white);
+
+                // the masks are grey, so their blue channel is the shade
+                const auto& next = frame->nextSolid;
+                const auto& tex =
+                    shapes.get(next.shape, next.rotation).pixels;
+                const uint32_t *const table =
+                    shades.data() + (next.color << 8);
+                for (uint32_t y = 0; y < tex.height(); ++y) {
+                    uint32_t *const pixels = preview.row(y);
+                    for (uint32_t x = 0; x < tex.width(); ++x) {
+                        const uint32_t pixel = tex.row(y)[x];
+                        pixels[x] = pixel == 0 ? white : table[pixel & 0xFF];
                     }
-                    const auto [r, g, b] =
-                        utils::Color(tex.at(x, y)).asDouble();
-                    canvas.set_pixel(x, y, r * rc * 255, g * gc * 255,
-                                     b * bc * 255);
                 }
-            }
+            });
         }));
 
     // CONTROLS
     w
         .register_component(make_unique<kiss::Label>(
-            canvas_end_x + 16, info_end_y + kiss_textfont.lineheight))
+            w.atlas(), canvas_end_x + 16,
+            info_end_y + kiss_textfont.lineheight))
         .update_text(
             "Controls:\n\n"
             "LEFT  -> move left\n"
@@ -186,60 +285,159 @@ int main() {
             "UP    -> rotate\n"
             "DOWN  -> speedup\n");
 
+#ifdef PROFILE
+    // PROFILER OVERLAY
+    auto& overlay = w.register_component(make_unique<kiss::Label>(
+        w.atlas(), canvas_end_x + 16,
+        info_end_y + kiss_textfont.lineheight * 9));
+    auto overlay_updated = std::chrono::steady_clock::now();
+    char overlay_text[512];
+#endif
+
+    // a stall longer than this many ticks is skipped instead of caught up
+    const uint32_t max_catch_up = 5;
+    utils::FixedStep scheduler(
+        std::chrono::milliseconds(game::Session::tickMs), max_catch_up);
+
     // GAME OVER WINDOW
     auto& game_over =
         w.register_component(make_unique<kiss::Container>(133, 236, 267, 177));
 
     auto& game_over_label =
         game_over.register_component(make_unique<kiss::Label>(
-            game_over.x + 80, game_over.y + kiss_textfont.lineheight));
+            w.atlas(), game_over.x + 80,
+            game_over.y + kiss_textfont.lineheight));
 
+    // set whenever frame holds something which isn't on the screen yet
+    bool fresh = true;
     game_over.register_component(make_unique<kiss::Button>(
         "Restart", game_over.x + 100, game_over.y + 120, [&] {
-            grid = game::SandGrid(grid.width(), grid.height());
-            grid.place_solid(gen_random_solid(grid.width() / 3));
-            state = GameState(gen_random_solid(grid.width() / 3));
+            const uint64_t seed = std::random_device()();
+            if (simulation) {
+                simulation->send({{}, seed});
+            } else {
+                games++;
+                start_session(seed);
+                scheduler.reset();
+                fresh = true;
+            }
             game_over.set_visibility(false);
         }));
 
     SDL_Event e;
-    int fps = 0;
+    char text[64];
+    // keys held down which the simulation thread knows about
+    game::Input sent;
     while (w.is_open()) {
-        SDL_Delay(10);
+        // Sleeps until the next tick or an event, for good after game over.
+        // The simulation thread has its own clock and sends an event with
+        // every frame.
+        const bool event =
+            simulation || frame->over
+                ? SDL_WaitEvent(&e)
+                : SDL_WaitEventTimeout(&e, scheduler.wait_ms());
+        if (event) {
+            PROFILE_SCOPE(input);
+            w.process_event(e);
+            while (SDL_PollEvent(&e)) {
+                w.process_event(e);
+            }
+        }
+
+        if (simulation) {
+            const game::Input input{k.is_key_down(SDL_SCANCODE_LEFT),
+                                    k.is_key_down(SDL_SCANCODE_RIGHT),
+                                    k.is_key_down(SDL_SCANCODE_DOWN),
+                                    k.is_key_down_once(SDL_SCANCODE_UP)};
+            const bool changed = input.left != sent.left ||
+                                 input.right != sent.right ||
+                                 input.down != sent.down || input.rotate;
+            if (changed && simulation->send({input, {}})) {
+                sent = input;
+            }
 
-        if (second >= 1.0) {
-            std::cout << fps << std::endl;
-            fps = -1;
-            second -= 1.0;
+            if (simulation->update()) {
+                frame = &simulation->frame();
+                fresh = true;
+            }
+        } else if (session->history() &&
+                   k.is_key_down_once(SDL_SCANCODE_BACKSPACE)) {
+            // also takes back a game over, the clock starts over from there
+            if (session->rewind(rewindTicks) != 0) {
+                scheduler.reset();
+                session->capture(captured);
+                captured.game = games;
+                fresh = true;
+            }
+        } else if (!session->is_over()) {
+            const uint32_t ticks = scheduler.due();
+            // a rotation is only done once, even when catching up
+            const bool rotate =
+                ticks != 0 && k.is_key_down_once(SDL_SCANCODE_UP);
+            game::Input input{k.is_key_down(SDL_SCANCODE_LEFT),
+                              k.is_key_down(SDL_SCANCODE_RIGHT),
+                              k.is_key_down(SDL_SCANCODE_DOWN), rotate};
+            for (uint32_t i = 0; i < ticks && session->tick(input); i++) {
+                if (recording) {
+                    recording->push(input);
+                }
+                input.rotate = false;
+            }
+
+            if (ticks != 0) {
+                session->capture(captured);
+                captured.game = games;
+                fresh = true;
+            }
         }
-        ++fps;
 
-        while (SDL_PollEvent(&e)) {
-            w.process_event(e);
+        // only what changed is drawn again, the labels ignore the same text
+        if (fresh) {
+            fresh = false;
+            canvas.mark_dirty();
+            next_shape.mark_dirty();
+            game_over.set_visibility(frame->over);
+
+            const int points = static_cast<int>(frame->score);
+            score.update_value(static_cast<uint64_t>(frame->score));
+            std::snprintf(text, sizeof(text), "Game over...\n\nScore: %d",
+                          points);
+            game_over_label.update_text(text);
         }
 
-        if (!state.game_over) {
-            // Again, I am sorry for using exceptions for
-            // control flow :(
-            try {
-                game_logic(w, k, grid, state);
-            } catch (const game::game_over_error&) {
-                state.game_over = true;
-                game_over.set_visibility(true);
-                w.force_redraw();
-            }
-            score.update_text("Score: " +
-                              std::to_string(static_cast<int>(state.score)));
-            game_over_label.update_text(
-                "Game over...\n\nScore: " +
-                std::to_string(static_cast<int>(state.score)));
+#ifdef PROFILE
+        const auto now = std::chrono::steady_clock::now();
+        if (now - overlay_updated > std::chrono::milliseconds(500)) {
+            overlay_updated = now;
+            profile_text(overlay_text, sizeof(overlay_text));
+            overlay.update_text(overlay_text);
         }
+#endif
 
         if (!w.is_ready()) {
             continue;
         }
 
-        w.draw();
+        {
+            PROFILE_SCOPE(draw);
+            w.draw();
+        }
+        PROFILE_SCOPE(present);
         w.flush();
     }
+
+    if (recording) {
+        recording->hash = session->grid().hash();
+        recording->save(record_path);
+    }
+    if (save_path != nullptr && session) {
+        session->save(save_path);
+    }
+
+#ifdef PROFILE
+    std::ofstream trace("tetrisand_trace.json");
+    utils::profiler().write_chrome_trace(trace);
+    std::ofstream csv("tetrisand_profile.csv");
+    utils::profiler().write_csv(csv);
+#endif
 }
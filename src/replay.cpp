@@ -0,0 +1,94 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "binary.hpp"
+
+namespace game {
+
+// File layout, all numbers little endian:
+//   "TSRP", version byte
+//   width, height, palette as u32, seed and tick count as u64
+//   a byte telling whether a u64 hash follows, and the hash
+//   runs until the ticks are used up: keys byte, tick count as LEB128
+static constexpr char magic[4] = {'T', 'S', 'R', 'P'};
+static constexpr uint8_t version = 1;
+
+using utils::read_le;
+using utils::read_varint;
+using utils::write_le;
+using utils::write_varint;
+
+void Recording::push(const Input& input) {
+    const uint8_t keys = input.left | input.right << 1 | input.down << 2 |
+                         input.rotate << 3;
+    if (runs.empty() || runs.back().keys != keys) {
+        runs.push_back({keys, 0});
+    }
+    runs.back().ticks++;
+    ticks_++;
+}
+
+void Recording::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    out.write(magic, sizeof(magic));
+    out.put(static_cast<char>(version));
+    write_le(out, width, 4);
+    write_le(out, height, 4);
+    write_le(out, palette, 4);
+    write_le(out, seed);
+    write_le(out, ticks_);
+    out.put(hash.has_value());
+    write_le(out, hash.value_or(0));
+
+    for (const auto& run : runs) {
+        out.put(static_cast<char>(run.keys));
+        write_varint(out, run.ticks);
+    }
+
+    if (!out) {
+        throw std::runtime_error("can't write recording " + path);
+    }
+}
+
+Recording Recording::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("can't open recording " + path);
+    }
+
+    char header[sizeof(magic)];
+    in.read(header, sizeof(header));
+    if (!in || !std::equal(header, header + sizeof(header), magic) ||
+        read_le(in, 1) != version) {
+        throw std::runtime_error("bad recording file format");
+    }
+
+    const auto width = static_cast<uint32_t>(read_le(in, 4));
+    const auto height = static_cast<uint32_t>(read_le(in, 4));
+    const auto palette = static_cast<uint32_t>(read_le(in, 4));
+    Recording recording(width, height, palette, read_le(in));
+    const uint64_t ticks = read_le(in);
+    const bool hashed = read_le(in, 1) != 0;
+    const uint64_t hash = read_le(in);
+    if (hashed) {
+        recording.hash = hash;
+    }
+
+    while (recording.ticks_ < ticks) {
+        const auto keys = static_cast<uint8_t>(read_le(in, 1));
+        const uint64_t count = read_varint(in);
+        if (keys > 15 || count == 0 || count > ticks - recording.ticks_) {
+            throw std::runtime_error("bad recording file format");
+        }
+        recording.runs.push_back({keys, count});
+        recording.ticks_ += count;
+    }
+    return recording;
+}
+
+}  // namespace game
@@ -0,0 +1,125 @@
+#include "session.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include "profiler.hpp"
+
+namespace game {
+
+Session::Session(uint32_t width, uint32_t height, const ShapeRegistry& shapes,
+                 uint32_t palette, uint64_t seed)
+    : colors(palette), grid_(width, height, shapes, seed) {
+    grid_.place_solid(random_solid());
+    nextSolid = random_solid();
+}
+
+Solid Session::random_solid() noexcept {
+    auto& random = grid_.random();
+    const auto shape = random.below(grid_.shape_registry().size());
+    const auto color = random.below(colors);
+    return {shape, 0, static_cast<uint8_t>(color), grid_.width() / 3, 0};
+}
+
+TickState Session::tick_state() noexcept {
+    return {ticks, score_, over, nextSolid, grid_.current_solid(),
+            grid_.random().state()};
+}
+
+void Session::keep_history(size_t maxBytes, uint32_t keyframeInterval) {
+    history_.emplace(grid_, tick_state(), maxBytes, keyframeInterval);
+}
+
+uint64_t Session::rewind(uint64_t count) {
+    if (!history_.has_value()) {
+        return 0;
+    }
+    const uint64_t steps = history_->rewind(grid_, count);
+    const auto& state = history_->state();
+    ticks = state.ticks;
+    score_ = state.score;
+    over = state.over;
+    nextSolid = state.nextSolid;
+    return steps;
+}
+
+void Session::resolve_collision() {
+    if (grid_.does_current_solid_collide()) {
+        grid_.convert_current_solid_to_sand();
+        grid_.place_solid(nextSolid);
+        nextSolid = random_solid();
+    }
+}
+
+void Session::advance(const Input& input) {
+    if (input.left) {
+        grid_.move_current_solid(Direction::left);
+        resolve_collision();
+    }
+    if (input.right) {
+        grid_.move_current_solid(Direction::right);
+        resolve_collision();
+    }
+    if (input.down) {
+        grid_.move_current_solid(Direction::down);
+        resolve_collision();
+        score_ += tickMs * 5 / 1000.0;
+    }
+    if (input.rotate) {
+        grid_.rotate_current_solid();
+        resolve_collision();
+    }
+
+    ticks++;
+    if (ticks % sandTicks == 0) {
+        grid_.update_sand();
+        resolve_collision();
+
+        const auto areas = grid_.find_areas();
+        if (areas != 0) {
+            PROFILE_COUNT(areasCleared, areas);
+            score_ += grid_.remove_areas() / 4;
+        }
+    }
+
+    grid_.move_current_solid(Direction::down);
+    resolve_collision();
+}
+
+void Session::capture(Frame& frame) const {
+    frame.width = grid_.width();
+    frame.height = grid_.height();
+    frame.cells.resize(static_cast<size_t>(frame.width) * frame.height);
+    frame.rowRevisions.resize(frame.height);
+    frame.revision = grid_.revision();
+
+    for (uint32_t y = 0; y < frame.height; y++) {
+        grid_.paint_row(y, frame.cells.data() + y * frame.width);
+        frame.rowRevisions[y] = grid_.row_revision(y);
+    }
+
+    frame.nextSolid = nextSolid;
+    frame.score = score_;
+    frame.over = over;
+}
+
+bool Session::tick(const Input& input) {
+    if (over) {
+        return false;
+    }
+    PROFILE_SCOPE(tick);
+
+    // I am still sorry for using exceptions for control flow :(
+    try {
+        advance(input);
+    } catch (const game_over_error&) {
+        over = true;
+    }
+    if (history_.has_value()) {
+        history_->push(grid_, tick_state());
+    }
+    PROFILE_END_TICK();
+    return true;
+}
+
+}  // namespace game
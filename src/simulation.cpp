@@ -0,0 +1,91 @@
+#include "simulation.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <utility>
+
+#include "scheduler.hpp"
+
+namespace game {
+
+SimulationThread::SimulationThread(uint32_t width, uint32_t height,
+                                   const ShapeRegistry& shapes,
+                                   uint32_t palette, uint64_t seed,
+                                   std::function<void()> published)
+    : registry(shapes),
+      columns(width),
+      rows(height),
+      colors(palette),
+      session(width, height, shapes, palette, seed),
+      onPublish(std::move(published)) {
+    // the window has the first frame before the thread even starts
+    publish();
+    frames.update();
+    thread = std::thread([this] { run(); });
+}
+
+SimulationThread::~SimulationThread() {
+    stop = true;
+    thread.join();
+}
+
+void SimulationThread::publish() {
+    auto& frame = frames.back();
+    session.capture(frame);
+    frame.game = game;
+    frames.publish();
+
+    if (onPublish) {
+        onPublish();
+    }
+}
+
+void SimulationThread::run() {
+    // a stall longer than this many ticks is skipped instead of caught up
+    const uint32_t maxCatchUp = 5;
+    utils::FixedStep scheduler(std::chrono::milliseconds(Session::tickMs),
+                               maxCatchUp);
+
+    Input held;
+    bool rotate = false;
+    while (!stop) {
+        // wakes every tick even after game over to look for a restart
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(scheduler.wait_ms()));
+
+        bool changed = false;
+        Command command;
+        while (commands.pop(command)) {
+            if (command.restart.has_value()) {
+                session = Session(columns, rows, registry, colors,
+                                  command.restart.value());
+                game++;
+                scheduler.reset();
+                rotate = false;
+                changed = true;
+            }
+            held = command.input;
+            rotate = rotate || command.input.rotate;
+        }
+
+        const uint32_t ticks = scheduler.due();
+        for (uint32_t i = 0; i < ticks; i++) {
+            Input input = held;
+            // a rotation is only done once, even when catching up
+            input.rotate = rotate;
+            if (!session.tick(input)) {
+                break;
+            }
+            rotate = false;
+            changed = true;
+        }
+
+        if (changed) {
+            publish();
+        }
+    }
+}
+
+}  // namespace game
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "binary.hpp"
+#include "game.hpp"
+#include "session.hpp"
+
+namespace game {
+
+// File layout, all numbers little endian:
+//   "TSSN", version byte
+//   palette as u32, tick count as u64, the bits of the score as a f64 and a
+//   byte telling whether the game is over
+//   the grid:
+//     width and height as u32, the random state as u64
+//     a byte telling whether the current solid follows, and the solid
+//     every row as runs of equal cells until the row is full: LEB128 of
+//     length << 2 | state, then the paint as u16 unless the cell is empty
+//     a bit for every chunk telling whether it is awake, eight to a byte
+//   the next solid
+// A solid is its shape as u32, rotation and color bytes, x and y as u32.
+//
+// Cells of the current solid are saved like any other, so loading only has
+// to remember which solid they belong to. Sand only moves the same way after
+// loading when the same chunks are asleep, so they are saved too.
+static constexpr char magic[4] = {'T', 'S', 'S', 'N'};
+static constexpr uint8_t version = 2;
+
+// Bigger grids are refused before anything is allocated for them, a broken
+// header can't ask for gigabytes
+static constexpr uint32_t maxSide = 1 << 16;
+static constexpr uint64_t maxCells = uint64_t(1) << 26;
+
+using utils::append_le;
+using utils::append_varint;
+using utils::read_le;
+using utils::read_varint;
+using utils::write_le;
+
+static void write_solid(std::ostream& out, const Solid& solid) {
+    write_le(out, solid.shape, 4);
+    out.put(static_cast<char>(solid.rotation));
+    out.put(static_cast<char>(solid.color));
+    write_le(out, solid.x, 4);
+    write_le(out, solid.y, 4);
+}
+
+// Throws when the solid doesn't fit on a grid of width x height
+static Solid read_solid(std::istream& in, const ShapeRegistry& shapes,
+                        uint32_t width, uint32_t height) {
+    Solid solid;
+    solid.shape = static_cast<uint32_t>(read_le(in, 4));
+    solid.rotation = static_cast<uint8_t>(read_le(in, 1));
+    solid.color = static_cast<uint8_t>(read_le(in, 1));
+    solid.x = static_cast<uint32_t>(read_le(in, 4));
+    solid.y = static_cast<uint32_t>(read_le(in, 4));
+
+    if (solid.shape >= shapes.size() ||
+        solid.rotation >= ShapeRegistry::rotations) {
+        throw std::runtime_error("snapshot has an unknown shape");
+    }
+    const auto& shape = shapes.get(solid.shape, solid.rotation);
+    if (solid.x > width || width - solid.x < shape.maxX ||
+        solid.y > height || height - solid.y < shape.maxY) {
+        throw std::runtime_error("snapshot has a solid off the grid");
+    }
+    return solid;
+}
+
+// Whether the cells under the opaque pixels of the solid are solid and
+// painted the way place_solid paints them
+static bool is_painted(const SandGrid& grid, const Solid& solid) {
+    const auto& shape = grid.shape_registry().get(solid.shape, solid.rotation);
+    for (uint32_t y = shape.minY; y < shape.maxY; y++) {
+        const uint32_t gy = solid.y + y;
+        const uint64_t solids = grid.filled_bits().window(solid.x, gy) &
+                                ~grid.sand_bits().window(solid.x, gy);
+        if ((solids & shape.occupancy[y]) != shape.occupancy[y]) {
+            return false;
+        }
+
+        const uint32_t *const pixels = shape.pixels.row(y);
+        for (uint64_t bits = shape.occupancy[y]; bits != 0;
+             bits &= bits - 1) {
+            const uint32_t x = __builtin_ctzll(bits);
+            if (grid.paint_at(solid.x + x, gy) !=
+                (solid.color << 8 | (pixels[x] & 0xFF))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void SandGrid::save(std::ostream& out) const {
+    write_le(out, width(), 4);
+    write_le(out, height(), 4);
+    write_le(out, rng.state());
+    out.put(currentSolid.has_value());
+    if (currentSolid.has_value()) {
+        write_solid(out, *currentSolid);
+    }
+
+    std::vector<uint16_t> row(width());
+    std::string bytes;
+    for (uint32_t y = 0; y < height(); y++) {
+        const uint64_t *const filled = filledBits.row(y);
+        // first filled cell from x on, or the width
+        const auto next_filled = [&](uint32_t x) {
+            uint32_t k = x / 64;
+            uint64_t word = filled[k] & ~uint64_t(0) << x % 64;
+            while (word == 0) {
+                if (++k == filledBits.stride()) {
+                    return width();
+                }
+                word = filled[k];
+            }
+            return std::min(width(), k * 64 + __builtin_ctzll(word));
+        };
+        const auto state = [&](uint32_t x) {
+            return sandBits.test(x, y)     ? GrainState::sand
+                   : filledBits.test(x, y) ? GrainState::solid
+                                           : GrainState::empty;
+        };
+
+        paint.copy_row(y, row.data());
+        bytes.clear();
+        for (uint32_t x = 0; x < width();) {
+            const GrainState cell = state(x);
+            uint32_t end = x + 1;
+            if (cell == GrainState::empty) {
+                end = next_filled(x);
+            } else {
+                while (end < width() && row[end] == row[x] &&
+                       state(end) == cell) {
+                    end++;
+                }
+            }
+
+            append_varint(bytes, static_cast<uint64_t>(end - x) << 2 |
+                                     static_cast<uint8_t>(cell));
+            if (cell != GrainState::empty) {
+                append_le(bytes, row[x], 2);
+            }
+            x = end;
+        }
+        out.write(bytes.data(), bytes.size());
+    }
+
+    std::string awake((awakeChunks.size() + 7) / 8, '\0');
+    for (size_t i = 0; i < awakeChunks.size(); i++) {
+        awake[i / 8] |= static_cast<char>((awakeChunks[i] != 0) << i % 8);
+    }
+    out.write(awake.data(), awake.size());
+}
+
+SandGrid SandGrid::load(std::istream& in, const ShapeRegistry& registry,
+                        uint32_t palette) {
+    const auto width = static_cast<uint32_t>(read_le(in, 4));
+    const auto height = static_cast<uint32_t>(read_le(in, 4));
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("snapshot has an empty grid");
+    }
+    if (width > maxSide || height > maxSide ||
+        static_cast<uint64_t>(width) * height > maxCells) {
+        throw std::runtime_error("snapshot has a grid too large");
+    }
+    SandGrid grid(width, height, registry, read_le(in));
+    const bool solid = read_le(in, 1) != 0;
+    if (solid) {
+        grid.currentSolid = read_solid(in, registry, width, height);
+        if (grid.currentSolid->color >= palette) {
+            throw std::runtime_error("snapshot has an unknown color");
+        }
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width;) {
+            const uint64_t run = read_varint(in);
+            const uint64_t length = run >> 2;
+            const auto state = static_cast<GrainState>(run & 3);
+            if (length == 0 || length > width - x ||
+                state > GrainState::sand) {
+                throw std::runtime_error("bad snapshot file format");
+            }
+
+            // the grid starts out empty
+            if (state != GrainState::empty) {
+                const auto cell = static_cast<uint16_t>(read_le(in, 2));
+                if ((cell >> 8) >= palette) {
+                    throw std::runtime_error("snapshot has an unknown color");
+                }
+                const Grain grain{state, static_cast<uint8_t>(cell),
+                                  static_cast<uint8_t>(cell >> 8)};
+                for (uint32_t i = 0; i < length; i++) {
+                    grid.put(x + i, y, grain);
+                }
+            }
+            x += static_cast<uint32_t>(length);
+        }
+    }
+
+    for (size_t i = 0; i < grid.awakeChunks.size(); i += 8) {
+        const auto bits = read_le(in, 1);
+        for (size_t j = i; j < std::min(i + 8, grid.awakeChunks.size()); j++) {
+            grid.awakeChunks[j] = bits >> j % 8 & 1;
+        }
+    }
+
+    if (solid && !is_painted(grid, *grid.currentSolid)) {
+        throw std::runtime_error("snapshot has a solid without its cells");
+    }
+    return grid;
+}
+
+void Session::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    out.write(magic, sizeof(magic));
+    out.put(static_cast<char>(version));
+    write_le(out, colors, 4);
+    write_le(out, ticks);
+    uint64_t score;
+    std::memcpy(&score, &score_, sizeof(score));
+    write_le(out, score);
+    out.put(over);
+    grid_.save(out);
+    write_solid(out, nextSolid);
+
+    if (!out) {
+        throw std::runtime_error("can't write snapshot " + path);
+    }
+}
+
+Session Session::load(const std::string& path, const ShapeRegistry& shapes,
+                      uint32_t palette) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("can't open snapshot " + path);
+    }
+
+    char header[sizeof(magic)];
+    in.read(header, sizeof(header));
+    if (!in || !std::equal(header, header + sizeof(header), magic) ||
+        read_le(in, 1) != version) {
+        throw std::runtime_error("bad snapshot file format");
+    }
+
+    if (read_le(in, 4) != palette) {
+        throw std::runtime_error("snapshot " + path +
+                                 " has another number of colors");
+    }
+    const uint64_t ticks = read_le(in);
+    const uint64_t score = read_le(in);
+    const bool over = read_le(in, 1) != 0;
+
+    Session session(palette, SandGrid::load(in, shapes, palette));
+    session.ticks = ticks;
+    std::memcpy(&session.score_, &score, sizeof(score));
+    session.over = over;
+    session.nextSolid = read_solid(in, shapes, session.grid_.width(),
+                                   session.grid_.height());
+    if (session.nextSolid.color >= palette) {
+        throw std::runtime_error("snapshot has an unknown color");
+    }
+    return session;
+}
+
+}  // namespace game
@@ -0,0 +1,102 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "game.hpp"
+#include "pnm.hpp"
+#include "texture.hpp"
+
+// Turns the images in the assets directory into assets.cpp, which defines
+// what assets.hpp declares. The masks are rotated and shaded here exactly
+// like game::ShapeRegistry would do it, so the game doesn't have to.
+//
+// Usage: tetrisand_bake ASSETS_DIR OUTPUT
+
+namespace {
+
+// Writes the pixels as an array called name and returns the initializer of
+// its Image
+std::string write_pixels(std::ostream& out, const std::string& name,
+                         const uint32_t *pixels, uint32_t width,
+                         uint32_t height) {
+    out << "constexpr uint32_t " << name << "[] = {";
+    char hex[16];
+    for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+        std::snprintf(hex, sizeof(hex), "0x%06X,", pixels[i]);
+        out << (i % 8 == 0 ? "\n    " : " ") << hex;
+    }
+    out << "\n};\n\n";
+    return "{" + std::to_string(width) + ", " + std::to_string(height) +
+           ", " + name + "}";
+}
+
+void write_images(std::ostream& out, const std::string& declaration,
+                  const std::vector<std::string>& images) {
+    out << declaration << " = {\n";
+    for (const auto& image : images) {
+        out << "    " << image << ",\n";
+    }
+    out << "};\n";
+}
+
+void bake(const std::string& dir, std::ostream& out) {
+    out << "// Generated by tetrisand_bake from the assets directory\n\n"
+           "#include <cstddef>\n#include <cstdint>\n\n"
+           "#include \"assets.hpp\"\n\nnamespace assets {\n\nnamespace {\n\n";
+
+    std::vector<std::string> masks;
+    for (auto mask : cfg::load_masks(dir)) {
+        for (uint8_t rotation = 0;
+             rotation < game::ShapeRegistry::rotations; rotation++) {
+            const std::string name = "mask" + std::to_string(masks.size());
+            masks.push_back(write_pixels(out, name, mask.row(0),
+                                         mask.width(), mask.height()));
+            mask = mask.ror();
+        }
+    }
+
+    std::vector<std::string> digits;
+    for (uint32_t digit = 0; digit < 10; digit++) {
+        const auto texture = utils::PnmParser::parse(
+            dir + "/" + std::to_string(digit) + ".ppm");
+        const std::string name = "digit" + std::to_string(digit);
+        digits.push_back(write_pixels(out, name, texture.row(0),
+                                      texture.width(), texture.height()));
+    }
+
+    out << "}  // namespace\n\n";
+    write_images(out, "constexpr Image masks[]", masks);
+    out << "constexpr size_t maskCount = " << masks.size() << ";\n\n";
+    write_images(out, "constexpr Image digits[10]", digits);
+    out << "\n}  // namespace assets\n";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " ASSETS_DIR OUTPUT" << std::endl;
+        return 1;
+    }
+
+    try {
+        // written to a string first, so a failed bake leaves no half file
+        std::ostringstream baked;
+        bake(argv[1], baked);
+
+        std::ofstream out(argv[2]);
+        out << baked.str();
+        if (!out) {
+            throw std::runtime_error(std::string("can't write ") + argv[2]);
+        }
+    } catch (const std::runtime_error& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+}